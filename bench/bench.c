@@ -0,0 +1,317 @@
+#define _POSIX_C_SOURCE 200809L
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "gen.h"
+#include "kanshi.h"
+#include "match.h"
+#include "parser.h"
+
+static bool counting_allocs = false;
+static uint64_t alloc_count = 0;
+
+#if defined(__GLIBC__)
+// Interpose the allocator to count allocations made by the benchmarked code,
+// including the ones made by libc (e.g. strdup or fopen)
+#define HAVE_ALLOC_COUNT 1
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size) {
+	if (counting_allocs) {
+		alloc_count++;
+	}
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+	if (counting_allocs) {
+		alloc_count++;
+	}
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+	if (counting_allocs) {
+		alloc_count++;
+	}
+	return __libc_realloc(ptr, size);
+}
+#else
+#define HAVE_ALLOC_COUNT 0
+#endif
+
+struct bench_ctx {
+	const char *config_path;
+	struct kanshi_config *config;
+	struct kanshi_matcher *matcher;
+	struct kanshi_match_pool *pool;
+	struct wl_list heads;
+	struct kanshi_profile *last_profile;
+	struct kanshi_head *last_head;
+};
+
+typedef void (*bench_func)(struct bench_ctx *ctx);
+
+static uint64_t min_time_ns = 200 * 1000 * 1000;
+static int match_threads = 3;
+
+static uint64_t get_time_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void run_bench(const char *name, int profiles, int outputs,
+		bench_func func, struct bench_ctx *ctx) {
+	uint64_t iterations = 1;
+	uint64_t elapsed;
+	while (1) {
+		alloc_count = 0;
+		counting_allocs = true;
+		uint64_t start = get_time_ns();
+		for (uint64_t i = 0; i < iterations; i++) {
+			func(ctx);
+		}
+		elapsed = get_time_ns() - start;
+		counting_allocs = false;
+
+		if (elapsed >= min_time_ns || iterations >= UINT64_MAX / 2) {
+			break;
+		}
+		// Aim slightly past the minimum time to avoid another round
+		uint64_t next = elapsed > 0 ?
+			iterations * min_time_ns / elapsed * 6 / 5 : iterations * 100;
+		iterations = next > iterations * 2 ? next : iterations * 2;
+	}
+
+	double ns_per_op = (double)elapsed / iterations;
+	if (HAVE_ALLOC_COUNT) {
+		printf("%-16s %8d %7d %14.1f %10.1f\n", name, profiles, outputs,
+			ns_per_op, (double)alloc_count / iterations);
+	} else {
+		printf("%-16s %8d %7d %14.1f %10s\n", name, profiles, outputs,
+			ns_per_op, "-");
+	}
+	fflush(stdout);
+}
+
+static void bench_parse_config(struct bench_ctx *ctx) {
+	struct kanshi_config *config = parse_config(ctx->config_path);
+	if (config == NULL) {
+		fprintf(stderr, "failed to parse generated config\n");
+		exit(EXIT_FAILURE);
+	}
+	destroy_config(config);
+}
+
+static void bench_match(struct bench_ctx *ctx) {
+	struct kanshi_profile_output *matches[HEADS_MAX];
+	if (match(ctx->config, &ctx->heads, matches) != ctx->last_profile) {
+		fprintf(stderr, "match() returned the wrong profile\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void bench_match_parallel(struct bench_ctx *ctx) {
+	struct kanshi_profile_output *matches[HEADS_MAX];
+	if (match_pool_match(ctx->pool, ctx->config, &ctx->heads, matches) !=
+			ctx->last_profile) {
+		fprintf(stderr, "match_pool_match() returned the wrong profile\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void bench_matcher_match(struct bench_ctx *ctx) {
+	struct kanshi_profile_output *matches[HEADS_MAX];
+	if (matcher_match(ctx->matcher, &ctx->heads, matches) !=
+			ctx->last_profile) {
+		fprintf(stderr, "matcher_match() returned the wrong profile\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+// Unplugs and plugs back a head, matching after each change
+static void bench_matcher_hotplug(struct bench_ctx *ctx) {
+	struct kanshi_profile_output *matches[HEADS_MAX];
+	matcher_remove_head(ctx->matcher, ctx->last_head);
+	matcher_match(ctx->matcher, &ctx->heads, matches);
+	matcher_add_head(ctx->matcher, ctx->last_head);
+	if (matcher_match(ctx->matcher, &ctx->heads, matches) !=
+			ctx->last_profile) {
+		fprintf(stderr, "matcher_match() returned the wrong profile\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void bench_match_profile(struct bench_ctx *ctx) {
+	struct kanshi_profile_output *matches[HEADS_MAX];
+	if (!match_profile(&ctx->heads, ctx->last_profile, matches)) {
+		fprintf(stderr, "match_profile() failed\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void bench_match_mode(struct bench_ctx *ctx) {
+	// The last advertised mode is the worst case for the lookup
+	struct kanshi_mode *last_mode =
+		wl_container_of(ctx->last_head->modes.prev, last_mode, link);
+	if (match_mode(ctx->last_head, last_mode->width, last_mode->height,
+			last_mode->refresh) != last_mode) {
+		fprintf(stderr, "match_mode() returned the wrong mode\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+static bool write_config(const char *path, int profiles, int outputs) {
+	FILE *f = fopen(path, "w");
+	if (f == NULL) {
+		perror("fopen");
+		return false;
+	}
+	gen_config(f, profiles, outputs);
+	if (fclose(f) != 0) {
+		perror("fclose");
+		return false;
+	}
+	return true;
+}
+
+static bool run_size(const char *path, int profiles, int outputs) {
+	if (!write_config(path, profiles, outputs)) {
+		return false;
+	}
+
+	struct bench_ctx ctx = { .config_path = path };
+	ctx.config = parse_config(path);
+	if (ctx.config == NULL) {
+		return false;
+	}
+	ctx.last_profile = wl_container_of(ctx.config->profiles.prev,
+		ctx.last_profile, link);
+	gen_heads(&ctx.heads, outputs);
+	ctx.last_head = wl_container_of(ctx.heads.prev, ctx.last_head, link);
+	ctx.matcher = matcher_create(ctx.config->compiled);
+	if (ctx.matcher == NULL) {
+		return false;
+	}
+	struct kanshi_head *head;
+	wl_list_for_each(head, &ctx.heads, link) {
+		matcher_add_head(ctx.matcher, head);
+	}
+
+	run_bench("parse_config", profiles, outputs, bench_parse_config, &ctx);
+	run_bench("match", profiles, outputs, bench_match, &ctx);
+	if (match_threads > 0) {
+		ctx.pool = match_pool_create(match_threads);
+		if (ctx.pool == NULL) {
+			return false;
+		}
+		run_bench("match_parallel", profiles, outputs, bench_match_parallel,
+			&ctx);
+		match_pool_destroy(ctx.pool);
+	}
+	run_bench("matcher_match", profiles, outputs, bench_matcher_match, &ctx);
+	run_bench("matcher_hotplug", profiles, outputs, bench_matcher_hotplug,
+		&ctx);
+	run_bench("match_profile", profiles, outputs, bench_match_profile, &ctx);
+	run_bench("match_mode", profiles, outputs, bench_match_mode, &ctx);
+
+	matcher_destroy(ctx.matcher);
+	gen_heads_finish(&ctx.heads);
+	destroy_config(ctx.config);
+	return true;
+}
+
+static const char usage[] = "Usage: %s [options...]\n"
+"  -h             Show help message and quit\n"
+"  -p <profiles>  Number of generated profiles (default: 10, 100, 1000)\n"
+"  -o <outputs>   Number of outputs per profile and of heads\n"
+"                 (default: 1, 4, 16)\n"
+"  -t <ms>        Minimum run time per benchmark (default: 200)\n"
+"  -j <threads>   Threads besides the main one for match_parallel, 0 to\n"
+"                 skip it (default: 3)\n";
+
+int main(int argc, char *argv[]) {
+	int profile_counts[] = { 10, 100, 1000 };
+	int output_counts[] = { 1, 4, 16 };
+	size_t n_profile_counts = sizeof(profile_counts) / sizeof(profile_counts[0]);
+	size_t n_output_counts = sizeof(output_counts) / sizeof(output_counts[0]);
+
+	int opt;
+	while ((opt = getopt(argc, argv, "hp:o:t:j:")) != -1) {
+		switch (opt) {
+		case 'p':
+			profile_counts[0] = atoi(optarg);
+			n_profile_counts = 1;
+			break;
+		case 'o':
+			output_counts[0] = atoi(optarg);
+			n_output_counts = 1;
+			break;
+		case 't':
+			min_time_ns = (uint64_t)atoi(optarg) * 1000 * 1000;
+			break;
+		case 'j':
+			match_threads = atoi(optarg);
+			break;
+		case 'h':
+			fprintf(stderr, usage, argv[0]);
+			return EXIT_SUCCESS;
+		default:
+			fprintf(stderr, usage, argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	for (size_t i = 0; i < n_output_counts; i++) {
+		if (output_counts[i] < 1 || output_counts[i] > HEADS_MAX) {
+			fprintf(stderr, "number of outputs must be between 1 and %d\n",
+				HEADS_MAX);
+			return EXIT_FAILURE;
+		}
+	}
+	for (size_t i = 0; i < n_profile_counts; i++) {
+		if (profile_counts[i] < 1) {
+			fprintf(stderr, "number of profiles must be positive\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	const char *tmpdir = getenv("TMPDIR");
+	char path[256];
+	snprintf(path, sizeof(path), "%s/kanshi-bench-XXXXXX",
+		tmpdir != NULL ? tmpdir : "/tmp");
+	int fd = mkstemp(path);
+	if (fd < 0) {
+		perror("mkstemp");
+		return EXIT_FAILURE;
+	}
+	close(fd);
+
+	printf("%-16s %8s %7s %14s %10s\n",
+		"benchmark", "profiles", "outputs", "ns/op", "allocs/op");
+
+	int ret = EXIT_SUCCESS;
+	for (size_t i = 0; i < n_profile_counts; i++) {
+		for (size_t j = 0; j < n_output_counts; j++) {
+			if (!run_size(path, profile_counts[i], output_counts[j])) {
+				ret = EXIT_FAILURE;
+				goto out;
+			}
+		}
+	}
+
+out:
+	unlink(path);
+	return ret;
+}
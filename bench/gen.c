@@ -0,0 +1,88 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gen.h"
+#include "kanshi.h"
+
+static const struct {
+	int width, height;
+} resolutions[] = {
+	{ 3840, 2160 },
+	{ 2560, 1440 },
+	{ 1920, 1080 },
+	{ 1280, 720 },
+};
+
+static const int refresh_rates[] = { 144000, 120000, 59940, 60000 };
+
+void gen_config(FILE *f, int profiles, int outputs) {
+	for (int i = 0; i < profiles; i++) {
+		fprintf(f, "profile gen-%d {\n", i);
+		if (i < profiles - 1) {
+			fprintf(f, "\toutput HDMI-A-%d disable\n", i);
+		}
+		int start = i < profiles - 1 ? 1 : 0;
+		for (int j = start; j < outputs; j++) {
+			switch ((i + j) % 3) {
+			case 0:
+				fprintf(f, "\toutput DP-%d", j);
+				break;
+			case 1:
+				fprintf(f, "\toutput \"Vendor Model-%d S%04d\"", j, j);
+				break;
+			case 2:
+				fprintf(f, "\toutput *");
+				break;
+			}
+			fprintf(f, " enable mode %dx%d@%dHz position %d,0 scale 1\n",
+				resolutions[j % 4].width, resolutions[j % 4].height,
+				refresh_rates[j % 4] / 1000, j * resolutions[0].width);
+		}
+		fprintf(f, "\texec echo gen-%d\n}\n\n", i);
+	}
+}
+
+void gen_heads(struct wl_list *heads, int count) {
+	wl_list_init(heads);
+	for (int i = 0; i < count; i++) {
+		struct kanshi_head *head = calloc(1, sizeof(*head));
+		char buf[64];
+		snprintf(buf, sizeof(buf), "DP-%d", i);
+		head->name = strdup(buf);
+		head->make = strdup("Vendor");
+		snprintf(buf, sizeof(buf), "Model-%d", i);
+		head->model = strdup(buf);
+		snprintf(buf, sizeof(buf), "S%04d", i);
+		head->serial_number = strdup(buf);
+		head->scale = 1.0;
+		wl_list_init(&head->modes);
+		for (int j = 0; j < GEN_MODES; j++) {
+			struct kanshi_mode *mode = calloc(1, sizeof(*mode));
+			mode->head = head;
+			mode->width = resolutions[j / 4 % 4].width;
+			mode->height = resolutions[j / 4 % 4].height;
+			mode->refresh = refresh_rates[j % 4];
+			wl_list_insert(head->modes.prev, &mode->link);
+		}
+		wl_list_insert(heads->prev, &head->link);
+	}
+}
+
+void gen_heads_finish(struct wl_list *heads) {
+	struct kanshi_head *head, *tmp_head;
+	wl_list_for_each_safe(head, tmp_head, heads, link) {
+		struct kanshi_mode *mode, *tmp_mode;
+		wl_list_for_each_safe(mode, tmp_mode, &head->modes, link) {
+			wl_list_remove(&mode->link);
+			free(mode);
+		}
+		wl_list_remove(&head->link);
+		free(head->name);
+		free(head->make);
+		free(head->model);
+		free(head->serial_number);
+		free(head);
+	}
+}
@@ -0,0 +1,26 @@
+#ifndef KANSHI_BENCH_GEN_H
+#define KANSHI_BENCH_GEN_H
+
+#include <stdio.h>
+#include <wayland-client.h>
+
+// Number of modes advertised by each generated head
+#define GEN_MODES 16
+
+/**
+ * Write a synthetic config with the given number of profiles, each with the
+ * given number of outputs. Outputs cycle through name, identifier and
+ * wildcard criteria. Every profile but the last one contains a criterion
+ * which never matches the heads created by gen_heads(), so that matching
+ * has to walk the whole profile list.
+ */
+void gen_config(FILE *f, int profiles, int outputs);
+
+/**
+ * Populate a list of kanshi_head with the given number of heads, each
+ * advertising GEN_MODES modes.
+ */
+void gen_heads(struct wl_list *heads, int count);
+void gen_heads_finish(struct wl_list *heads);
+
+#endif
@@ -0,0 +1,1493 @@
+#define _POSIX_C_SOURCE 200809L
+#include <ctype.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <wayland-server.h>
+
+#include "wlr-output-management-unstable-v1-server-protocol.h"
+
+#define MANAGER_VERSION 4
+#define MODE_VERSION 3
+#define SCRIPT_ARGS_MAX 16
+#define REPEAT_DEPTH_MAX 16
+
+struct mock_mode {
+	struct mock_head *head;
+	struct wl_list link;
+	struct wl_list resources;
+
+	int32_t width, height, refresh;
+	bool preferred;
+};
+
+struct mock_head {
+	struct mock_state *state;
+	struct wl_list link;
+	struct wl_list resources;
+	bool announced;
+
+	char *name, *description;
+	char *make, *model, *serial_number;
+	int32_t phys_width, phys_height;
+	struct wl_list modes;
+
+	bool enabled;
+	struct mock_mode *current_mode;
+	int32_t x, y;
+	int32_t transform;
+	wl_fixed_t scale;
+	bool adaptive_sync;
+};
+
+struct mock_config_head {
+	struct mock_config *config;
+	struct mock_head *head;
+	struct wl_list link;
+
+	bool enabled;
+	struct mock_mode *mode;
+	bool has_position;
+	int32_t x, y;
+	bool has_transform;
+	int32_t transform;
+	bool has_scale;
+	wl_fixed_t scale;
+	bool has_adaptive_sync;
+	bool adaptive_sync;
+};
+
+enum mock_reply_type {
+	MOCK_REPLY_SUCCEEDED,
+	MOCK_REPLY_FAILED,
+	MOCK_REPLY_CANCELLED,
+};
+
+struct mock_config {
+	struct mock_state *state;
+	struct wl_resource *resource;
+	struct wl_list link;
+	struct wl_list heads;
+	uint32_t serial;
+	bool used, test;
+
+	enum mock_reply_type reply;
+	struct wl_event_source *reply_timer;
+	struct wl_list deferred_link;
+};
+
+struct mock_reply {
+	struct wl_list link;
+	enum mock_reply_type type;
+	int delay_ms;
+};
+
+struct script_cmd {
+	int line;
+	int argc;
+	char *argv[SCRIPT_ARGS_MAX];
+};
+
+struct mock_state {
+	struct wl_display *display;
+	struct wl_event_loop *loop;
+	struct wl_list managers;
+	struct wl_list heads;
+	struct wl_list configs;
+	struct wl_list replies;
+	uint32_t serial;
+	int exit_status;
+
+	struct script_cmd *cmds;
+	size_t cmds_len;
+	size_t pc;
+	struct {
+		size_t start;
+		long remaining; // -1 means forever
+	} repeat[REPEAT_DEPTH_MAX];
+	int repeat_depth;
+	bool waiting_apply;
+	struct wl_event_source *wait_timer;
+	bool fast;
+	// Applied configurations wait for a reply command in the script
+	bool defer_replies;
+	struct wl_list deferred; // mock_config.deferred_link
+
+	pid_t child;
+	// Memory use of the child at the last memory-mark command, in KiB
+	struct {
+		bool marked;
+		int line;
+		long rss_kib, data_kib;
+		long max_rss_growth_kib, max_data_growth_kib;
+	} memory;
+
+	// Statistics
+	uint64_t last_done_ns;
+	bool done_pending_apply;
+	uint64_t done_count, apply_count;
+	uint64_t reply_counts[3];
+	uint64_t latency_min_ns, latency_max_ns, latency_sum_ns;
+	uint64_t latency_count;
+};
+
+static const char *reply_names[] = {
+	[MOCK_REPLY_SUCCEEDED] = "succeeded",
+	[MOCK_REPLY_FAILED] = "failed",
+	[MOCK_REPLY_CANCELLED] = "cancelled",
+};
+
+static void run_script(struct mock_state *state);
+
+static uint64_t get_time_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static struct wl_resource *mode_resource_for_client(struct mock_mode *mode,
+		struct wl_client *client) {
+	if (mode == NULL) {
+		return NULL;
+	}
+	struct wl_resource *resource;
+	wl_resource_for_each(resource, &mode->resources) {
+		if (wl_resource_get_client(resource) == client) {
+			return resource;
+		}
+	}
+	return NULL;
+}
+
+static void resource_remove_link(struct wl_resource *resource) {
+	struct wl_list *link = wl_resource_get_link(resource);
+	wl_list_remove(link);
+	wl_list_init(link);
+}
+
+static void handle_release(struct wl_client *client,
+		struct wl_resource *resource) {
+	wl_resource_destroy(resource);
+}
+
+static const struct zwlr_output_mode_v1_interface mode_impl = {
+	.release = handle_release,
+};
+
+static const struct zwlr_output_head_v1_interface head_impl = {
+	.release = handle_release,
+};
+
+static void send_mode(struct wl_resource *head_resource,
+		struct mock_mode *mode) {
+	struct wl_client *client = wl_resource_get_client(head_resource);
+	int version = wl_resource_get_version(head_resource);
+	if (version > MODE_VERSION) {
+		version = MODE_VERSION;
+	}
+	struct wl_resource *resource = wl_resource_create(client,
+		&zwlr_output_mode_v1_interface, version, 0);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &mode_impl, mode,
+		resource_remove_link);
+	wl_list_insert(&mode->resources, wl_resource_get_link(resource));
+
+	zwlr_output_head_v1_send_mode(head_resource, resource);
+	zwlr_output_mode_v1_send_size(resource, mode->width, mode->height);
+	if (mode->refresh > 0) {
+		zwlr_output_mode_v1_send_refresh(resource, mode->refresh);
+	}
+	if (mode->preferred) {
+		zwlr_output_mode_v1_send_preferred(resource);
+	}
+}
+
+static void send_head_current_state(struct wl_resource *resource,
+		struct mock_head *head) {
+	zwlr_output_head_v1_send_enabled(resource, head->enabled);
+	if (head->enabled) {
+		struct wl_resource *mode_resource = mode_resource_for_client(
+			head->current_mode, wl_resource_get_client(resource));
+		if (mode_resource != NULL) {
+			zwlr_output_head_v1_send_current_mode(resource, mode_resource);
+		}
+		zwlr_output_head_v1_send_position(resource, head->x, head->y);
+		zwlr_output_head_v1_send_transform(resource, head->transform);
+		zwlr_output_head_v1_send_scale(resource, head->scale);
+	}
+	if (wl_resource_get_version(resource) >=
+			ZWLR_OUTPUT_HEAD_V1_ADAPTIVE_SYNC_SINCE_VERSION) {
+		zwlr_output_head_v1_send_adaptive_sync(resource, head->adaptive_sync ?
+			ZWLR_OUTPUT_HEAD_V1_ADAPTIVE_SYNC_STATE_ENABLED :
+			ZWLR_OUTPUT_HEAD_V1_ADAPTIVE_SYNC_STATE_DISABLED);
+	}
+}
+
+static void send_head(struct wl_resource *manager_resource,
+		struct mock_head *head) {
+	struct wl_client *client = wl_resource_get_client(manager_resource);
+	int version = wl_resource_get_version(manager_resource);
+	struct wl_resource *resource = wl_resource_create(client,
+		&zwlr_output_head_v1_interface, version, 0);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &head_impl, head,
+		resource_remove_link);
+	wl_list_insert(&head->resources, wl_resource_get_link(resource));
+
+	zwlr_output_manager_v1_send_head(manager_resource, resource);
+	zwlr_output_head_v1_send_name(resource, head->name);
+	zwlr_output_head_v1_send_description(resource, head->description);
+	if (head->phys_width > 0 && head->phys_height > 0) {
+		zwlr_output_head_v1_send_physical_size(resource,
+			head->phys_width, head->phys_height);
+	}
+	if (version >= ZWLR_OUTPUT_HEAD_V1_MAKE_SINCE_VERSION) {
+		if (head->make != NULL) {
+			zwlr_output_head_v1_send_make(resource, head->make);
+		}
+		if (head->model != NULL) {
+			zwlr_output_head_v1_send_model(resource, head->model);
+		}
+		if (head->serial_number != NULL) {
+			zwlr_output_head_v1_send_serial_number(resource,
+				head->serial_number);
+		}
+	}
+	struct mock_mode *mode;
+	wl_list_for_each(mode, &head->modes, link) {
+		send_mode(resource, mode);
+	}
+	send_head_current_state(resource, head);
+}
+
+static void send_done(struct mock_state *state) {
+	state->serial++;
+	struct wl_resource *resource;
+	wl_resource_for_each(resource, &state->managers) {
+		zwlr_output_manager_v1_send_done(resource, state->serial);
+	}
+	wl_display_flush_clients(state->display);
+
+	state->done_count++;
+	state->last_done_ns = get_time_ns();
+	state->done_pending_apply = true;
+}
+
+static void destroy_mode(struct mock_mode *mode) {
+	struct wl_resource *resource, *tmp;
+	wl_resource_for_each_safe(resource, tmp, &mode->resources) {
+		zwlr_output_mode_v1_send_finished(resource);
+		wl_resource_set_user_data(resource, NULL);
+		resource_remove_link(resource);
+	}
+	wl_list_remove(&mode->link);
+	free(mode);
+}
+
+static void destroy_head(struct mock_head *head) {
+	// Detach the head from in-flight configurations, they will be cancelled
+	struct mock_config *config;
+	wl_list_for_each(config, &head->state->configs, link) {
+		struct mock_config_head *config_head;
+		wl_list_for_each(config_head, &config->heads, link) {
+			if (config_head->head == head) {
+				config_head->head = NULL;
+				config_head->mode = NULL;
+			}
+		}
+	}
+
+	struct mock_mode *mode, *tmp_mode;
+	wl_list_for_each_safe(mode, tmp_mode, &head->modes, link) {
+		destroy_mode(mode);
+	}
+
+	struct wl_resource *resource, *tmp;
+	wl_resource_for_each_safe(resource, tmp, &head->resources) {
+		zwlr_output_head_v1_send_finished(resource);
+		wl_resource_set_user_data(resource, NULL);
+		resource_remove_link(resource);
+	}
+
+	wl_list_remove(&head->link);
+	free(head->name);
+	free(head->description);
+	free(head->make);
+	free(head->model);
+	free(head->serial_number);
+	free(head);
+}
+
+static void config_head_handle_set_mode(struct wl_client *client,
+		struct wl_resource *resource, struct wl_resource *mode_resource) {
+	struct mock_config_head *config_head = wl_resource_get_user_data(resource);
+	if (config_head == NULL || config_head->config == NULL) {
+		return;
+	}
+	config_head->mode = wl_resource_get_user_data(mode_resource);
+}
+
+static void config_head_handle_set_custom_mode(struct wl_client *client,
+		struct wl_resource *resource, int32_t width, int32_t height,
+		int32_t refresh) {
+	// Custom modes are not supported, always fail the configuration
+	struct mock_config_head *config_head = wl_resource_get_user_data(resource);
+	if (config_head == NULL || config_head->config == NULL) {
+		return;
+	}
+	config_head->mode = NULL;
+}
+
+static void config_head_handle_set_position(struct wl_client *client,
+		struct wl_resource *resource, int32_t x, int32_t y) {
+	struct mock_config_head *config_head = wl_resource_get_user_data(resource);
+	if (config_head == NULL || config_head->config == NULL) {
+		return;
+	}
+	config_head->has_position = true;
+	config_head->x = x;
+	config_head->y = y;
+}
+
+static void config_head_handle_set_transform(struct wl_client *client,
+		struct wl_resource *resource, int32_t transform) {
+	struct mock_config_head *config_head = wl_resource_get_user_data(resource);
+	if (config_head == NULL || config_head->config == NULL) {
+		return;
+	}
+	if (transform < 0 || transform > WL_OUTPUT_TRANSFORM_FLIPPED_270) {
+		wl_resource_post_error(resource,
+			ZWLR_OUTPUT_CONFIGURATION_HEAD_V1_ERROR_INVALID_TRANSFORM,
+			"invalid transform %d", transform);
+		return;
+	}
+	config_head->has_transform = true;
+	config_head->transform = transform;
+}
+
+static void config_head_handle_set_scale(struct wl_client *client,
+		struct wl_resource *resource, wl_fixed_t scale) {
+	struct mock_config_head *config_head = wl_resource_get_user_data(resource);
+	if (config_head == NULL || config_head->config == NULL) {
+		return;
+	}
+	if (scale <= 0) {
+		wl_resource_post_error(resource,
+			ZWLR_OUTPUT_CONFIGURATION_HEAD_V1_ERROR_INVALID_SCALE,
+			"invalid scale");
+		return;
+	}
+	config_head->has_scale = true;
+	config_head->scale = scale;
+}
+
+static void config_head_handle_set_adaptive_sync(struct wl_client *client,
+		struct wl_resource *resource, uint32_t state) {
+	struct mock_config_head *config_head = wl_resource_get_user_data(resource);
+	if (config_head == NULL || config_head->config == NULL) {
+		return;
+	}
+	config_head->has_adaptive_sync = true;
+	config_head->adaptive_sync =
+		state == ZWLR_OUTPUT_HEAD_V1_ADAPTIVE_SYNC_STATE_ENABLED;
+}
+
+static const struct zwlr_output_configuration_head_v1_interface
+		config_head_impl = {
+	.set_mode = config_head_handle_set_mode,
+	.set_custom_mode = config_head_handle_set_custom_mode,
+	.set_position = config_head_handle_set_position,
+	.set_transform = config_head_handle_set_transform,
+	.set_scale = config_head_handle_set_scale,
+	.set_adaptive_sync = config_head_handle_set_adaptive_sync,
+};
+
+static void config_head_handle_resource_destroy(struct wl_resource *resource) {
+	struct mock_config_head *config_head = wl_resource_get_user_data(resource);
+	if (config_head == NULL) {
+		return;
+	}
+	wl_list_remove(&config_head->link);
+	free(config_head);
+}
+
+static struct mock_config *config_from_resource(struct wl_resource *resource) {
+	struct mock_config *config = wl_resource_get_user_data(resource);
+	if (config != NULL && config->used) {
+		wl_resource_post_error(resource,
+			ZWLR_OUTPUT_CONFIGURATION_V1_ERROR_ALREADY_USED,
+			"configuration already used");
+		return NULL;
+	}
+	return config;
+}
+
+static struct mock_config_head *config_add_head(struct mock_config *config,
+		struct wl_resource *resource, struct wl_resource *head_resource,
+		bool enabled) {
+	struct mock_head *head = wl_resource_get_user_data(head_resource);
+	struct mock_config_head *config_head;
+	wl_list_for_each(config_head, &config->heads, link) {
+		if (head != NULL && config_head->head == head) {
+			wl_resource_post_error(resource,
+				ZWLR_OUTPUT_CONFIGURATION_V1_ERROR_ALREADY_CONFIGURED_HEAD,
+				"head configured twice");
+			return NULL;
+		}
+	}
+
+	config_head = calloc(1, sizeof(*config_head));
+	if (config_head == NULL) {
+		wl_resource_post_no_memory(resource);
+		return NULL;
+	}
+	config_head->config = config;
+	config_head->head = head;
+	config_head->enabled = enabled;
+	if (head != NULL) {
+		config_head->mode = head->current_mode;
+	}
+	wl_list_insert(config->heads.prev, &config_head->link);
+	return config_head;
+}
+
+static void config_handle_enable_head(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id,
+		struct wl_resource *head_resource) {
+	struct mock_config *config = config_from_resource(resource);
+	if (config == NULL) {
+		return;
+	}
+	struct mock_config_head *config_head =
+		config_add_head(config, resource, head_resource, true);
+	if (config_head == NULL) {
+		return;
+	}
+
+	struct wl_resource *config_head_resource = wl_resource_create(client,
+		&zwlr_output_configuration_head_v1_interface,
+		wl_resource_get_version(resource), id);
+	if (config_head_resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(config_head_resource, &config_head_impl,
+		config_head, config_head_handle_resource_destroy);
+}
+
+static void config_handle_disable_head(struct wl_client *client,
+		struct wl_resource *resource, struct wl_resource *head_resource) {
+	struct mock_config *config = config_from_resource(resource);
+	if (config == NULL) {
+		return;
+	}
+	config_add_head(config, resource, head_resource, false);
+}
+
+static void config_send_reply(struct mock_config *config) {
+	struct mock_state *state = config->state;
+	enum mock_reply_type reply = config->reply;
+
+	// The configuration is outdated if a head went away in the meantime
+	struct mock_config_head *config_head;
+	wl_list_for_each(config_head, &config->heads, link) {
+		if (config_head->head == NULL) {
+			reply = MOCK_REPLY_CANCELLED;
+		}
+	}
+	if (config->serial != state->serial) {
+		reply = MOCK_REPLY_CANCELLED;
+	}
+
+	state->reply_counts[reply]++;
+	switch (reply) {
+	case MOCK_REPLY_SUCCEEDED:
+		zwlr_output_configuration_v1_send_succeeded(config->resource);
+		break;
+	case MOCK_REPLY_FAILED:
+		zwlr_output_configuration_v1_send_failed(config->resource);
+		break;
+	case MOCK_REPLY_CANCELLED:
+		zwlr_output_configuration_v1_send_cancelled(config->resource);
+		break;
+	}
+
+	if (reply != MOCK_REPLY_SUCCEEDED || config->test) {
+		wl_display_flush_clients(state->display);
+		return;
+	}
+
+	wl_list_for_each(config_head, &config->heads, link) {
+		struct mock_head *head = config_head->head;
+		head->enabled = config_head->enabled;
+		if (!head->enabled) {
+			continue;
+		}
+		if (config_head->mode != NULL) {
+			head->current_mode = config_head->mode;
+		}
+		if (config_head->has_position) {
+			head->x = config_head->x;
+			head->y = config_head->y;
+		}
+		if (config_head->has_transform) {
+			head->transform = config_head->transform;
+		}
+		if (config_head->has_scale) {
+			head->scale = config_head->scale;
+		}
+		if (config_head->has_adaptive_sync) {
+			head->adaptive_sync = config_head->adaptive_sync;
+		}
+	}
+
+	// Like a real compositor, broadcast the new state
+	struct mock_head *head;
+	wl_list_for_each(head, &state->heads, link) {
+		struct wl_resource *head_resource;
+		wl_resource_for_each(head_resource, &head->resources) {
+			send_head_current_state(head_resource, head);
+		}
+	}
+	send_done(state);
+}
+
+static int handle_reply_timer(void *data) {
+	struct mock_config *config = data;
+	wl_event_source_remove(config->reply_timer);
+	config->reply_timer = NULL;
+	config_send_reply(config);
+	return 0;
+}
+
+static void config_apply(struct wl_client *client,
+		struct wl_resource *resource, bool test) {
+	struct mock_config *config = config_from_resource(resource);
+	if (config == NULL) {
+		return;
+	}
+	struct mock_state *state = config->state;
+	config->used = true;
+	config->test = test;
+
+	struct mock_head *head;
+	wl_list_for_each(head, &state->heads, link) {
+		if (!head->announced) {
+			continue;
+		}
+		bool found = false;
+		struct mock_config_head *config_head;
+		wl_list_for_each(config_head, &config->heads, link) {
+			if (config_head->head == head) {
+				found = true;
+				break;
+			}
+		}
+		if (!found && config->serial == state->serial) {
+			wl_resource_post_error(resource,
+				ZWLR_OUTPUT_CONFIGURATION_V1_ERROR_UNCONFIGURED_HEAD,
+				"head '%s' not configured", head->name);
+			return;
+		}
+	}
+
+	state->apply_count++;
+	if (state->done_pending_apply) {
+		uint64_t latency = get_time_ns() - state->last_done_ns;
+		if (state->latency_count == 0 || latency < state->latency_min_ns) {
+			state->latency_min_ns = latency;
+		}
+		if (latency > state->latency_max_ns) {
+			state->latency_max_ns = latency;
+		}
+		state->latency_sum_ns += latency;
+		state->latency_count++;
+		state->done_pending_apply = false;
+	}
+
+	int delay_ms = 0;
+	config->reply = MOCK_REPLY_SUCCEEDED;
+	if (wl_list_empty(&state->replies) && state->defer_replies) {
+		wl_list_insert(state->deferred.prev, &config->deferred_link);
+	} else if (!wl_list_empty(&state->replies)) {
+		struct mock_reply *reply =
+			wl_container_of(state->replies.next, reply, link);
+		config->reply = reply->type;
+		delay_ms = reply->delay_ms;
+		wl_list_remove(&reply->link);
+		free(reply);
+	}
+
+	if (!wl_list_empty(&config->deferred_link)) {
+		// The reply will be sent by a reply command
+	} else if (delay_ms > 0 && !state->fast) {
+		config->reply_timer = wl_event_loop_add_timer(state->loop,
+			handle_reply_timer, config);
+		wl_event_source_timer_update(config->reply_timer, delay_ms);
+	} else {
+		config_send_reply(config);
+	}
+
+	if (state->waiting_apply) {
+		state->waiting_apply = false;
+		wl_event_source_timer_update(state->wait_timer, 0);
+		run_script(state);
+	}
+}
+
+static void config_handle_apply(struct wl_client *client,
+		struct wl_resource *resource) {
+	config_apply(client, resource, false);
+}
+
+static void config_handle_test(struct wl_client *client,
+		struct wl_resource *resource) {
+	config_apply(client, resource, true);
+}
+
+static void config_handle_destroy(struct wl_client *client,
+		struct wl_resource *resource) {
+	wl_resource_destroy(resource);
+}
+
+static const struct zwlr_output_configuration_v1_interface config_impl = {
+	.enable_head = config_handle_enable_head,
+	.disable_head = config_handle_disable_head,
+	.apply = config_handle_apply,
+	.test = config_handle_test,
+	.destroy = config_handle_destroy,
+};
+
+static void config_handle_resource_destroy(struct wl_resource *resource) {
+	struct mock_config *config = wl_resource_get_user_data(resource);
+	if (config->reply_timer != NULL) {
+		wl_event_source_remove(config->reply_timer);
+	}
+	wl_list_remove(&config->deferred_link);
+	struct mock_config_head *config_head, *tmp;
+	wl_list_for_each_safe(config_head, tmp, &config->heads, link) {
+		// Configuration head resources outlive the configuration
+		config_head->config = NULL;
+		wl_list_remove(&config_head->link);
+		wl_list_init(&config_head->link);
+	}
+	wl_list_remove(&config->link);
+	free(config);
+}
+
+static void manager_handle_create_configuration(struct wl_client *client,
+		struct wl_resource *manager_resource, uint32_t id, uint32_t serial) {
+	struct mock_state *state = wl_resource_get_user_data(manager_resource);
+
+	struct mock_config *config = calloc(1, sizeof(*config));
+	if (config == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	config->state = state;
+	config->serial = serial;
+	wl_list_init(&config->heads);
+	wl_list_init(&config->deferred_link);
+
+	config->resource = wl_resource_create(client,
+		&zwlr_output_configuration_v1_interface,
+		wl_resource_get_version(manager_resource), id);
+	if (config->resource == NULL) {
+		free(config);
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(config->resource, &config_impl, config,
+		config_handle_resource_destroy);
+	wl_list_insert(&state->configs, &config->link);
+}
+
+static void manager_handle_stop(struct wl_client *client,
+		struct wl_resource *resource) {
+	zwlr_output_manager_v1_send_finished(resource);
+	wl_resource_destroy(resource);
+}
+
+static const struct zwlr_output_manager_v1_interface manager_impl = {
+	.create_configuration = manager_handle_create_configuration,
+	.stop = manager_handle_stop,
+};
+
+static void manager_bind(struct wl_client *client, void *data,
+		uint32_t version, uint32_t id) {
+	struct mock_state *state = data;
+
+	struct wl_resource *resource = wl_resource_create(client,
+		&zwlr_output_manager_v1_interface, version, id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &manager_impl, state,
+		resource_remove_link);
+	wl_list_insert(&state->managers, wl_resource_get_link(resource));
+
+	struct mock_head *head;
+	wl_list_for_each(head, &state->heads, link) {
+		if (head->announced) {
+			send_head(resource, head);
+		}
+	}
+	zwlr_output_manager_v1_send_done(resource, state->serial);
+}
+
+static struct mock_head *find_head(struct mock_state *state,
+		const char *name) {
+	struct mock_head *head;
+	wl_list_for_each(head, &state->heads, link) {
+		if (strcmp(head->name, name) == 0) {
+			return head;
+		}
+	}
+	return NULL;
+}
+
+static bool parse_mode(const char *str, int32_t *width, int32_t *height,
+		int32_t *refresh) {
+	float hz = 0;
+	int n = sscanf(str, "%" SCNd32 "x%" SCNd32 "@%f", width, height, &hz);
+	if (n < 2 || *width <= 0 || *height <= 0) {
+		return false;
+	}
+	*refresh = (int32_t)(hz * 1000 + 0.5);
+	return true;
+}
+
+static bool cmd_head(struct mock_state *state, struct script_cmd *cmd) {
+	if (cmd->argc < 2 || cmd->argc % 2 != 0) {
+		return false;
+	}
+	if (find_head(state, cmd->argv[1]) != NULL) {
+		fprintf(stderr, "head '%s' already exists\n", cmd->argv[1]);
+		return false;
+	}
+
+	struct mock_head *head = calloc(1, sizeof(*head));
+	if (head == NULL) {
+		return false;
+	}
+	head->state = state;
+	head->name = strdup(cmd->argv[1]);
+	head->scale = wl_fixed_from_int(1);
+	wl_list_init(&head->resources);
+	wl_list_init(&head->modes);
+	wl_list_insert(state->heads.prev, &head->link);
+
+	for (int i = 2; i < cmd->argc; i += 2) {
+		const char *key = cmd->argv[i], *value = cmd->argv[i + 1];
+		if (strcmp(key, "make") == 0) {
+			head->make = strdup(value);
+		} else if (strcmp(key, "model") == 0) {
+			head->model = strdup(value);
+		} else if (strcmp(key, "serial") == 0) {
+			head->serial_number = strdup(value);
+		} else if (strcmp(key, "description") == 0) {
+			head->description = strdup(value);
+		} else if (strcmp(key, "size") == 0) {
+			if (sscanf(value, "%" SCNd32 "x%" SCNd32,
+					&head->phys_width, &head->phys_height) != 2) {
+				return false;
+			}
+		} else {
+			fprintf(stderr, "unknown head property '%s'\n", key);
+			return false;
+		}
+	}
+
+	if (head->description == NULL) {
+		char description[512];
+		snprintf(description, sizeof(description), "%s %s %s (%s)",
+			head->make ? head->make : "Unknown",
+			head->model ? head->model : "Unknown",
+			head->serial_number ? head->serial_number : "Unknown",
+			head->name);
+		head->description = strdup(description);
+	}
+	return true;
+}
+
+static bool cmd_mode(struct mock_state *state, struct script_cmd *cmd) {
+	if (cmd->argc < 3) {
+		return false;
+	}
+	struct mock_head *head = find_head(state, cmd->argv[1]);
+	if (head == NULL) {
+		fprintf(stderr, "unknown head '%s'\n", cmd->argv[1]);
+		return false;
+	}
+
+	struct mock_mode *mode = calloc(1, sizeof(*mode));
+	if (mode == NULL) {
+		return false;
+	}
+	mode->head = head;
+	wl_list_init(&mode->resources);
+	wl_list_insert(head->modes.prev, &mode->link);
+	if (!parse_mode(cmd->argv[2], &mode->width, &mode->height,
+			&mode->refresh)) {
+		fprintf(stderr, "invalid mode '%s'\n", cmd->argv[2]);
+		return false;
+	}
+
+	for (int i = 3; i < cmd->argc; i++) {
+		if (strcmp(cmd->argv[i], "preferred") == 0) {
+			mode->preferred = true;
+		} else if (strcmp(cmd->argv[i], "current") == 0) {
+			head->enabled = true;
+			head->current_mode = mode;
+		} else {
+			fprintf(stderr, "unknown mode flag '%s'\n", cmd->argv[i]);
+			return false;
+		}
+	}
+
+	if (head->announced) {
+		struct wl_resource *resource;
+		wl_resource_for_each(resource, &head->resources) {
+			send_mode(resource, mode);
+			if (head->current_mode == mode) {
+				send_head_current_state(resource, head);
+			}
+		}
+	}
+	return true;
+}
+
+static bool cmd_unplug(struct mock_state *state, struct script_cmd *cmd) {
+	if (cmd->argc != 2) {
+		return false;
+	}
+	struct mock_head *head = find_head(state, cmd->argv[1]);
+	if (head == NULL) {
+		fprintf(stderr, "unknown head '%s'\n", cmd->argv[1]);
+		return false;
+	}
+	destroy_head(head);
+	return true;
+}
+
+static bool cmd_describe(struct mock_state *state, struct script_cmd *cmd) {
+	if (cmd->argc != 3) {
+		return false;
+	}
+	struct mock_head *head = find_head(state, cmd->argv[1]);
+	if (head == NULL) {
+		fprintf(stderr, "unknown head '%s'\n", cmd->argv[1]);
+		return false;
+	}
+	char *description = strdup(cmd->argv[2]);
+	if (description == NULL) {
+		return false;
+	}
+	free(head->description);
+	head->description = description;
+
+	if (head->announced) {
+		struct wl_resource *resource;
+		wl_resource_for_each(resource, &head->resources) {
+			zwlr_output_head_v1_send_description(resource, head->description);
+		}
+	}
+	return true;
+}
+
+// Reads the resident and data segment sizes of the child from /proc. The
+// latter only grows with heap allocations which are never freed.
+static bool read_child_memory(struct mock_state *state, long *rss_kib,
+		long *data_kib) {
+	if (state->child <= 0) {
+		fprintf(stderr, "no command to measure\n");
+		return false;
+	}
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/%d/status", (int)state->child);
+	FILE *f = fopen(path, "r");
+	if (f == NULL) {
+		fprintf(stderr, "failed to open %s: %s\n", path, strerror(errno));
+		return false;
+	}
+	*rss_kib = *data_kib = -1;
+	char line[256];
+	while (fgets(line, sizeof(line), f) != NULL) {
+		sscanf(line, "VmRSS: %ld kB", rss_kib);
+		sscanf(line, "VmData: %ld kB", data_kib);
+	}
+	fclose(f);
+	return *rss_kib >= 0 && *data_kib >= 0;
+}
+
+static bool cmd_memory_mark(struct mock_state *state, struct script_cmd *cmd) {
+	if (cmd->argc != 1 || !read_child_memory(state,
+			&state->memory.rss_kib, &state->memory.data_kib)) {
+		return false;
+	}
+	state->memory.marked = true;
+	state->memory.line = cmd->line;
+	return true;
+}
+
+static bool cmd_memory_check(struct mock_state *state, struct script_cmd *cmd) {
+	if (cmd->argc != 2 || !state->memory.marked) {
+		return false;
+	}
+	long max_growth_kib = atol(cmd->argv[1]);
+	long rss_kib, data_kib;
+	if (!read_child_memory(state, &rss_kib, &data_kib)) {
+		return false;
+	}
+	long rss_growth_kib = rss_kib - state->memory.rss_kib;
+	long data_growth_kib = data_kib - state->memory.data_kib;
+	if (rss_growth_kib > state->memory.max_rss_growth_kib) {
+		state->memory.max_rss_growth_kib = rss_growth_kib;
+	}
+	if (data_growth_kib > state->memory.max_data_growth_kib) {
+		state->memory.max_data_growth_kib = data_growth_kib;
+	}
+	if (rss_growth_kib > max_growth_kib || data_growth_kib > max_growth_kib) {
+		fprintf(stderr, "client memory grew by %ld KiB resident and %ld KiB "
+			"data since line %d\n", rss_growth_kib, data_growth_kib,
+			state->memory.line);
+		return false;
+	}
+	return true;
+}
+
+static bool cmd_done(struct mock_state *state, struct script_cmd *cmd) {
+	struct mock_head *head;
+	wl_list_for_each(head, &state->heads, link) {
+		if (head->announced) {
+			continue;
+		}
+		head->announced = true;
+		struct wl_resource *resource;
+		wl_resource_for_each(resource, &state->managers) {
+			send_head(resource, head);
+		}
+	}
+	send_done(state);
+	return true;
+}
+
+static bool cmd_reply(struct mock_state *state, struct script_cmd *cmd) {
+	if (cmd->argc < 2 || cmd->argc > 3) {
+		return false;
+	}
+	struct mock_reply *reply = calloc(1, sizeof(*reply));
+	if (reply == NULL) {
+		return false;
+	}
+	wl_list_insert(state->replies.prev, &reply->link);
+
+	bool found = false;
+	for (size_t i = 0; i < sizeof(reply_names) / sizeof(reply_names[0]); i++) {
+		if (strcmp(cmd->argv[1], reply_names[i]) == 0) {
+			reply->type = i;
+			found = true;
+		}
+	}
+	if (!found) {
+		fprintf(stderr, "unknown reply '%s'\n", cmd->argv[1]);
+		return false;
+	}
+	if (cmd->argc == 3) {
+		reply->delay_ms = atoi(cmd->argv[2]);
+	}
+
+	if (!wl_list_empty(&state->deferred)) {
+		// Answer the oldest applied configuration
+		struct mock_config *config =
+			wl_container_of(state->deferred.next, config, deferred_link);
+		wl_list_remove(&config->deferred_link);
+		wl_list_init(&config->deferred_link);
+		config->reply = reply->type;
+		wl_list_remove(&reply->link);
+		free(reply);
+		config_send_reply(config);
+	}
+	return true;
+}
+
+static struct mock_mode *find_mode(struct mock_head *head, const char *str) {
+	int32_t width, height, refresh;
+	if (!parse_mode(str, &width, &height, &refresh)) {
+		return NULL;
+	}
+	struct mock_mode *mode;
+	wl_list_for_each(mode, &head->modes, link) {
+		if (mode->width == width && mode->height == height &&
+				mode->refresh == refresh) {
+			return mode;
+		}
+	}
+	return NULL;
+}
+
+static bool cmd_state(struct mock_state *state, struct script_cmd *cmd) {
+	if (cmd->argc < 2) {
+		return false;
+	}
+	struct mock_head *head = find_head(state, cmd->argv[1]);
+	if (head == NULL) {
+		fprintf(stderr, "unknown head '%s'\n", cmd->argv[1]);
+		return false;
+	}
+
+	for (int i = 2; i < cmd->argc; i++) {
+		const char *key = cmd->argv[i];
+		if (strcmp(key, "enabled") == 0) {
+			head->enabled = true;
+			continue;
+		} else if (strcmp(key, "disabled") == 0) {
+			head->enabled = false;
+			continue;
+		}
+
+		if (i + 1 >= cmd->argc) {
+			return false;
+		}
+		const char *value = cmd->argv[++i];
+		if (strcmp(key, "mode") == 0) {
+			head->current_mode = find_mode(head, value);
+			if (head->current_mode == NULL) {
+				fprintf(stderr, "unknown mode '%s'\n", value);
+				return false;
+			}
+		} else if (strcmp(key, "position") == 0) {
+			if (sscanf(value, "%" SCNd32 ",%" SCNd32,
+					&head->x, &head->y) != 2) {
+				return false;
+			}
+		} else if (strcmp(key, "transform") == 0) {
+			head->transform = atoi(value);
+		} else if (strcmp(key, "scale") == 0) {
+			head->scale = wl_fixed_from_double(atof(value));
+		} else if (strcmp(key, "adaptive_sync") == 0) {
+			head->adaptive_sync = strcmp(value, "on") == 0;
+		} else {
+			fprintf(stderr, "unknown head state '%s'\n", key);
+			return false;
+		}
+	}
+
+	if (head->announced) {
+		struct wl_resource *resource;
+		wl_resource_for_each(resource, &head->resources) {
+			send_head_current_state(resource, head);
+		}
+	}
+	return true;
+}
+
+static int handle_wait_timer(void *data) {
+	struct mock_state *state = data;
+	if (state->waiting_apply) {
+		struct script_cmd *cmd = &state->cmds[state->pc - 1];
+		fprintf(stderr, "timed out waiting for an apply on line %d\n",
+			cmd->line);
+		state->exit_status = EXIT_FAILURE;
+		wl_display_terminate(state->display);
+		return 0;
+	}
+	run_script(state);
+	return 0;
+}
+
+static void run_script(struct mock_state *state) {
+	while (state->pc < state->cmds_len) {
+		struct script_cmd *cmd = &state->cmds[state->pc];
+		state->pc++;
+
+		const char *name = cmd->argv[0];
+		bool ok = true;
+		if (strcmp(name, "head") == 0) {
+			ok = cmd_head(state, cmd);
+		} else if (strcmp(name, "mode") == 0) {
+			ok = cmd_mode(state, cmd);
+		} else if (strcmp(name, "unplug") == 0) {
+			ok = cmd_unplug(state, cmd);
+		} else if (strcmp(name, "describe") == 0) {
+			ok = cmd_describe(state, cmd);
+		} else if (strcmp(name, "memory-mark") == 0) {
+			ok = cmd_memory_mark(state, cmd);
+		} else if (strcmp(name, "memory-check") == 0) {
+			ok = cmd_memory_check(state, cmd);
+		} else if (strcmp(name, "done") == 0) {
+			ok = cmd_done(state, cmd);
+		} else if (strcmp(name, "state") == 0) {
+			ok = cmd_state(state, cmd);
+		} else if (strcmp(name, "reply") == 0) {
+			ok = cmd_reply(state, cmd);
+		} else if (strcmp(name, "defer-replies") == 0) {
+			state->defer_replies = true;
+		} else if (strcmp(name, "wait") == 0) {
+			int ms = cmd->argc == 2 ? atoi(cmd->argv[1]) : 0;
+			if (ms > 0 && !state->fast) {
+				wl_event_source_timer_update(state->wait_timer, ms);
+				return;
+			}
+		} else if (strcmp(name, "wait-apply") == 0) {
+			state->waiting_apply = true;
+			int timeout_ms = cmd->argc == 2 ? atoi(cmd->argv[1]) : 0;
+			if (timeout_ms > 0) {
+				wl_event_source_timer_update(state->wait_timer, timeout_ms);
+			}
+			return;
+		} else if (strcmp(name, "repeat") == 0) {
+			if (cmd->argc != 2 || state->repeat_depth >= REPEAT_DEPTH_MAX) {
+				ok = false;
+			} else {
+				long count = atol(cmd->argv[1]);
+				state->repeat[state->repeat_depth].start = state->pc;
+				state->repeat[state->repeat_depth].remaining =
+					count > 0 ? count : -1;
+				state->repeat_depth++;
+			}
+		} else if (strcmp(name, "end") == 0) {
+			if (state->repeat_depth == 0) {
+				ok = false;
+			} else {
+				int depth = state->repeat_depth - 1;
+				if (state->repeat[depth].remaining > 0) {
+					state->repeat[depth].remaining--;
+				}
+				if (state->repeat[depth].remaining != 0) {
+					state->pc = state->repeat[depth].start;
+				} else {
+					state->repeat_depth--;
+				}
+			}
+		} else if (strcmp(name, "exit") == 0) {
+			state->exit_status = cmd->argc == 2 ? atoi(cmd->argv[1]) : 0;
+			wl_display_terminate(state->display);
+			return;
+		} else {
+			fprintf(stderr, "unknown command '%s'\n", name);
+			ok = false;
+		}
+
+		if (!ok) {
+			fprintf(stderr, "script error on line %d\n", cmd->line);
+			state->exit_status = EXIT_FAILURE;
+			wl_display_terminate(state->display);
+			return;
+		}
+	}
+}
+
+static bool tokenize(char *line, struct script_cmd *cmd) {
+	char *p = line;
+	while (1) {
+		while (isspace((unsigned char)*p)) {
+			p++;
+		}
+		if (*p == '\0' || *p == '#') {
+			return true;
+		}
+		if (cmd->argc >= SCRIPT_ARGS_MAX) {
+			return false;
+		}
+
+		char *start, *end;
+		if (*p == '"') {
+			// Quoted strings support \", \\ and \n, unescaped in place
+			start = ++p;
+			char *out = p;
+			while (*p != '\0' && *p != '"') {
+				if (*p == '\\') {
+					p++;
+					if (*p == 'n') {
+						*p = '\n';
+					} else if (*p != '"' && *p != '\\') {
+						return false;
+					}
+				}
+				*out++ = *p++;
+			}
+			if (*p != '"') {
+				return false;
+			}
+			end = out;
+		} else {
+			start = p;
+			while (*p != '\0' && !isspace((unsigned char)*p)) {
+				p++;
+			}
+			end = p;
+		}
+		bool last = *p == '\0';
+		*p = '\0';
+		*end = '\0';
+		cmd->argv[cmd->argc++] = strdup(start);
+		if (last) {
+			return true;
+		}
+		p++;
+	}
+}
+
+static bool load_script(struct mock_state *state, const char *path) {
+	FILE *f = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+	if (f == NULL) {
+		fprintf(stderr, "failed to open %s: %s\n", path, strerror(errno));
+		return false;
+	}
+
+	size_t cap = 0;
+	char *line = NULL;
+	size_t line_size = 0;
+	int lineno = 0;
+	bool ok = true;
+	while (getline(&line, &line_size, f) >= 0) {
+		lineno++;
+		if (state->cmds_len == cap) {
+			cap = cap > 0 ? cap * 2 : 64;
+			struct script_cmd *cmds =
+				realloc(state->cmds, cap * sizeof(*cmds));
+			if (cmds == NULL) {
+				ok = false;
+				break;
+			}
+			state->cmds = cmds;
+		}
+
+		struct script_cmd *cmd = &state->cmds[state->cmds_len];
+		memset(cmd, 0, sizeof(*cmd));
+		cmd->line = lineno;
+		if (!tokenize(line, cmd)) {
+			fprintf(stderr, "%s:%d: invalid line\n", path, lineno);
+			ok = false;
+			break;
+		}
+		if (cmd->argc > 0) {
+			state->cmds_len++;
+		}
+	}
+
+	free(line);
+	if (f != stdin) {
+		fclose(f);
+	}
+	return ok;
+}
+
+static int handle_signal(int signum, void *data) {
+	struct mock_state *state = data;
+	if (signum == SIGCHLD && state->child > 0) {
+		int status;
+		if (waitpid(state->child, &status, WNOHANG) != state->child) {
+			return 0;
+		}
+		state->child = -1;
+		if (WIFEXITED(status)) {
+			state->exit_status = WEXITSTATUS(status);
+		} else {
+			state->exit_status = EXIT_FAILURE;
+		}
+	} else if (signum == SIGCHLD) {
+		return 0;
+	}
+	wl_display_terminate(state->display);
+	return 0;
+}
+
+static void handle_start(void *data) {
+	struct mock_state *state = data;
+	run_script(state);
+}
+
+static pid_t spawn(const char *socket, char *argv[]) {
+	pid_t pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return -1;
+	} else if (pid == 0) {
+		// The event loop blocks the signals it handles
+		sigset_t set;
+		sigemptyset(&set);
+		sigprocmask(SIG_SETMASK, &set, NULL);
+
+		setenv("WAYLAND_DISPLAY", socket, true);
+		execvp(argv[0], argv);
+		fprintf(stderr, "failed to execute %s: %s\n", argv[0],
+			strerror(errno));
+		_exit(127);
+	}
+	return pid;
+}
+
+static void print_stats(struct mock_state *state) {
+	fprintf(stderr, "done events: %" PRIu64 ", applies: %" PRIu64
+		" (succeeded: %" PRIu64 ", failed: %" PRIu64
+		", cancelled: %" PRIu64 ")\n",
+		state->done_count, state->apply_count,
+		state->reply_counts[MOCK_REPLY_SUCCEEDED],
+		state->reply_counts[MOCK_REPLY_FAILED],
+		state->reply_counts[MOCK_REPLY_CANCELLED]);
+	if (state->latency_count > 0) {
+		fprintf(stderr, "done to apply latency: min %.3fms, "
+			"avg %.3fms, max %.3fms\n",
+			(double)state->latency_min_ns / 1000000,
+			(double)state->latency_sum_ns / state->latency_count / 1000000,
+			(double)state->latency_max_ns / 1000000);
+	}
+	if (state->memory.marked) {
+		fprintf(stderr, "client memory growth since line %d: "
+			"max %ld KiB resident, %ld KiB data\n", state->memory.line,
+			state->memory.max_rss_growth_kib,
+			state->memory.max_data_growth_kib);
+	}
+}
+
+static const char usage[] = "Usage: %s [options...] <script> [-- command...]\n"
+"  -h            Show help message and quit\n"
+"  -s <socket>   Wayland socket name (default: automatic)\n"
+"  -f            Skip waits and reply delays, e.g. to replay a trace\n"
+"                as fast as possible\n"
+"\n"
+"Script commands, one per line, values with spaces are quoted and can escape\n"
+"\\\", \\\\ and \\n with a backslash:\n"
+"  head <name> [make|model|serial|description|size <value>]...\n"
+"  mode <head> <width>x<height>[@<hz>] [preferred] [current]\n"
+"  state <head> [enabled|disabled] [mode|position|transform|scale|\n"
+"        adaptive_sync <value>]...\n"
+"  unplug <head>\n"
+"  describe <head> <description>  (sends the description again)\n"
+"  done\n"
+"  reply succeeded|failed|cancelled [<delay-ms>]\n"
+"  defer-replies  (applies wait for the next reply command)\n"
+"  wait <ms>\n"
+"  wait-apply [<timeout-ms>]\n"
+"  repeat <count>  (0 repeats forever)\n"
+"  end\n"
+"  memory-mark  (records the memory use of the command)\n"
+"  memory-check <max-growth-kib>\n"
+"  exit [<status>]\n";
+
+int main(int argc, char *argv[]) {
+	const char *socket = NULL;
+	int opt;
+	bool fast = false;
+	while ((opt = getopt(argc, argv, "hs:f")) != -1) {
+		switch (opt) {
+		case 's':
+			socket = optarg;
+			break;
+		case 'f':
+			fast = true;
+			break;
+		case 'h':
+			fprintf(stderr, usage, argv[0]);
+			return EXIT_SUCCESS;
+		default:
+			fprintf(stderr, usage, argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (optind >= argc) {
+		fprintf(stderr, usage, argv[0]);
+		return EXIT_FAILURE;
+	}
+	const char *script_path = argv[optind++];
+	char **command = NULL;
+	if (optind < argc) {
+		command = &argv[optind];
+	}
+
+	struct mock_state state = { .fast = fast };
+	wl_list_init(&state.managers);
+	wl_list_init(&state.deferred);
+	wl_list_init(&state.heads);
+	wl_list_init(&state.configs);
+	wl_list_init(&state.replies);
+
+	if (!load_script(&state, script_path)) {
+		return EXIT_FAILURE;
+	}
+
+	state.display = wl_display_create();
+	if (state.display == NULL) {
+		fprintf(stderr, "failed to create display\n");
+		return EXIT_FAILURE;
+	}
+	state.loop = wl_display_get_event_loop(state.display);
+
+	if (socket != NULL) {
+		if (wl_display_add_socket(state.display, socket) != 0) {
+			fprintf(stderr, "failed to add socket %s\n", socket);
+			return EXIT_FAILURE;
+		}
+	} else {
+		socket = wl_display_add_socket_auto(state.display);
+		if (socket == NULL) {
+			fprintf(stderr, "failed to add socket\n");
+			return EXIT_FAILURE;
+		}
+	}
+	printf("%s\n", socket);
+	fflush(stdout);
+
+	wl_global_create(state.display, &zwlr_output_manager_v1_interface,
+		MANAGER_VERSION, &state, manager_bind);
+
+	wl_event_loop_add_signal(state.loop, SIGINT, handle_signal, &state);
+	wl_event_loop_add_signal(state.loop, SIGTERM, handle_signal, &state);
+	wl_event_loop_add_signal(state.loop, SIGCHLD, handle_signal, &state);
+	state.wait_timer = wl_event_loop_add_timer(state.loop,
+		handle_wait_timer, &state);
+
+	if (command != NULL) {
+		state.child = spawn(socket, command);
+		if (state.child < 0) {
+			return EXIT_FAILURE;
+		}
+	}
+
+	// Start the script once the display is running, so that it can terminate it
+	wl_event_loop_add_idle(state.loop, handle_start, &state);
+	wl_display_run(state.display);
+
+	if (state.child > 0) {
+		kill(state.child, SIGTERM);
+		waitpid(state.child, NULL, 0);
+	}
+	print_stats(&state);
+
+	wl_display_destroy_clients(state.display);
+	struct mock_head *head, *tmp_head;
+	wl_list_for_each_safe(head, tmp_head, &state.heads, link) {
+		destroy_head(head);
+	}
+	struct mock_reply *reply, *tmp_reply;
+	wl_list_for_each_safe(reply, tmp_reply, &state.replies, link) {
+		wl_list_remove(&reply->link);
+		free(reply);
+	}
+	for (size_t i = 0; i < state.cmds_len; i++) {
+		for (int j = 0; j < state.cmds[i].argc; j++) {
+			free(state.cmds[i].argv[j]);
+		}
+	}
+	free(state.cmds);
+	wl_display_destroy(state.display);
+	return state.exit_status;
+}
@@ -0,0 +1,130 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "config.h"
+#include "gen.h"
+#include "parser.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+	struct kanshi_config *config =
+		parse_config_buffer((const char *)data, size);
+	if (config != NULL) {
+		destroy_config(config);
+	}
+	return 0;
+}
+
+#ifndef KANSHI_FUZZ
+static uint64_t get_time_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static bool run_file(const char *path) {
+	FILE *f = fopen(path, "r");
+	if (f == NULL) {
+		fprintf(stderr, "failed to open %s: %s\n", path, strerror(errno));
+		return false;
+	}
+
+	char *buf = NULL;
+	size_t size = 0, cap = 0;
+	while (!feof(f)) {
+		if (size == cap) {
+			cap = cap > 0 ? cap * 2 : 4096;
+			char *new_buf = realloc(buf, cap);
+			if (new_buf == NULL) {
+				free(buf);
+				fclose(f);
+				return false;
+			}
+			buf = new_buf;
+		}
+		size += fread(buf + size, 1, cap - size, f);
+		if (ferror(f)) {
+			fprintf(stderr, "failed to read %s\n", path);
+			free(buf);
+			fclose(f);
+			return false;
+		}
+	}
+	fclose(f);
+
+	LLVMFuzzerTestOneInput((const uint8_t *)buf, size);
+	free(buf);
+	return true;
+}
+
+static bool run_throughput(int profiles, int outputs) {
+	char *buf = NULL;
+	size_t size = 0;
+	FILE *f = open_memstream(&buf, &size);
+	if (f == NULL) {
+		perror("open_memstream");
+		return false;
+	}
+	gen_config(f, profiles, outputs);
+	fclose(f);
+
+	// Repeat until at least one second of parsing has been measured
+	uint64_t elapsed = 0;
+	int iterations = 0;
+	while (elapsed < 1000000000) {
+		uint64_t start = get_time_ns();
+		struct kanshi_config *config = parse_config_buffer(buf, size);
+		elapsed += get_time_ns() - start;
+		iterations++;
+		if (config == NULL) {
+			fprintf(stderr, "failed to parse generated config\n");
+			free(buf);
+			return false;
+		}
+		destroy_config(config);
+	}
+
+	double secs = (double)elapsed / 1000000000;
+	printf("%8d %7d %12zu %10.2f %14.0f\n", profiles, outputs, size,
+		(double)size * iterations / secs / (1024 * 1024),
+		(double)profiles * iterations / secs);
+	free(buf);
+	return true;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc > 1) {
+		// Replay the given inputs, e.g. a fuzzing corpus or crash reproducers
+		for (int i = 1; i < argc; i++) {
+			if (!run_file(argv[i])) {
+				return EXIT_FAILURE;
+			}
+		}
+		return EXIT_SUCCESS;
+	}
+
+	static const struct {
+		int profiles, outputs;
+	} sizes[] = {
+		{ 100, 4 },
+		{ 1000, 4 },
+		{ 1000, 16 },
+		{ 10000, 16 },
+	};
+
+	printf("%8s %7s %12s %10s %14s\n",
+		"profiles", "outputs", "bytes", "MB/s", "profiles/s");
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		if (!run_throughput(sizes[i].profiles, sizes[i].outputs)) {
+			return EXIT_FAILURE;
+		}
+	}
+	return EXIT_SUCCESS;
+}
+#endif
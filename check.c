@@ -0,0 +1,185 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "check.h"
+#include "config.h"
+#include "match.h"
+
+static uint32_t hash_bytes(uint32_t hash, const void *data, size_t len) {
+	// FNV-1a
+	for (const unsigned char *c = data; len > 0; c++, len--) {
+		hash = (hash ^ *c) * 16777619u;
+	}
+	return hash;
+}
+
+// Profiles with the same hash and criteria match the same heads: matching
+// only depends on the criteria, their order and whether heads can be left
+// unlisted
+static uint32_t hash_profile(const struct kanshi_compiled_config *compiled,
+		const struct kanshi_compiled_profile *profile) {
+	uint32_t header[] = {
+		profile->required_len,
+		profile->outputs_len,
+		profile->unlisted != KANSHI_UNLISTED_NONE,
+	};
+	uint32_t hash = hash_bytes(2166136261u, header, sizeof(header));
+	for (uint32_t k = 0; k < profile->outputs_len; k++) {
+		const struct kanshi_compiled_output *output =
+			&compiled->outputs[profile->outputs_offset + k];
+		uint32_t key[] = {output->criterion, output->id};
+		hash = hash_bytes(hash, key, sizeof(key));
+		if (output->criterion == KANSHI_CRITERION_PATTERN) {
+			hash = hash_bytes(hash, output->output->name,
+				strlen(output->output->name));
+		}
+	}
+	return hash;
+}
+
+static bool same_criteria(const struct kanshi_compiled_config *compiled,
+		const struct kanshi_compiled_profile *a,
+		const struct kanshi_compiled_profile *b) {
+	if (a->required_len != b->required_len ||
+			a->outputs_len != b->outputs_len ||
+			(a->unlisted != KANSHI_UNLISTED_NONE) !=
+			(b->unlisted != KANSHI_UNLISTED_NONE)) {
+		return false;
+	}
+	for (uint32_t k = 0; k < a->outputs_len; k++) {
+		const struct kanshi_compiled_output *output_a =
+			&compiled->outputs[a->outputs_offset + k];
+		const struct kanshi_compiled_output *output_b =
+			&compiled->outputs[b->outputs_offset + k];
+		if (output_a->criterion != output_b->criterion ||
+				output_a->id != output_b->id) {
+			return false;
+		}
+		if (output_a->criterion == KANSHI_CRITERION_PATTERN &&
+				strcmp(output_a->output->name, output_b->output->name) != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Numbers of heads a profile can match
+struct head_range {
+	uint32_t min, max; // max is UINT32_MAX if unbounded
+};
+
+static struct head_range get_head_range(
+		const struct kanshi_compiled_profile *profile) {
+	return (struct head_range){
+		.min = profile->required_len,
+		.max = profile->unlisted != KANSHI_UNLISTED_NONE ?
+			UINT32_MAX : profile->outputs_len,
+	};
+}
+
+// Such a profile matches any set of heads within its head range
+static bool has_only_wildcards(const struct kanshi_compiled_config *compiled,
+		const struct kanshi_compiled_profile *profile) {
+	for (uint32_t k = 0; k < profile->outputs_len; k++) {
+		if (compiled->outputs[profile->outputs_offset + k].criterion !=
+				KANSHI_CRITERION_WILDCARD) {
+			return false;
+		}
+	}
+	return true;
+}
+
+ssize_t check_compiled_config(const struct kanshi_compiled_config *compiled,
+		struct kanshi_check_result *results) {
+	size_t cap = 1;
+	while (cap < 2 * compiled->profiles_len) {
+		cap *= 2;
+	}
+	// Open-addressing table of the first profile with each criteria, slots
+	// hold the profile index plus one
+	uint32_t *first = calloc(cap, sizeof(*first));
+	// Earlier profiles with only wildcards, none of which shadows another
+	uint32_t *wildcards = calloc(compiled->profiles_len + 1,
+		sizeof(*wildcards));
+	if (first == NULL || wildcards == NULL) {
+		free(first);
+		free(wildcards);
+		return -1;
+	}
+	size_t wildcards_len = 0;
+
+	ssize_t unreachable = 0;
+	for (uint32_t p = 0; p < compiled->profiles_len; p++) {
+		const struct kanshi_compiled_profile *profile = &compiled->profiles[p];
+		struct kanshi_check_result *result = &results[p];
+		*result = (struct kanshi_check_result){0};
+
+		if (profile->required_len > HEADS_MAX) {
+			result->reason = KANSHI_CHECK_TOO_MANY_OUTPUTS;
+			unreachable++;
+			continue;
+		}
+
+		size_t slot = hash_profile(compiled, profile) & (cap - 1);
+		while (first[slot] != 0 && !same_criteria(compiled,
+				&compiled->profiles[first[slot] - 1], profile)) {
+			slot = (slot + 1) & (cap - 1);
+		}
+		if (first[slot] != 0) {
+			result->reason = KANSHI_CHECK_DUPLICATE;
+			result->shadowed_by = first[slot] - 1;
+			unreachable++;
+			continue;
+		}
+		first[slot] = p + 1;
+
+		struct head_range range = get_head_range(profile);
+		for (size_t i = 0; i < wildcards_len; i++) {
+			struct head_range other =
+				get_head_range(&compiled->profiles[wildcards[i]]);
+			if (other.min <= range.min && range.max <= other.max) {
+				result->reason = KANSHI_CHECK_SHADOWED;
+				result->shadowed_by = wildcards[i];
+				break;
+			}
+		}
+		if (result->reason != KANSHI_CHECK_REACHABLE) {
+			unreachable++;
+			continue;
+		}
+		if (has_only_wildcards(compiled, profile)) {
+			wildcards[wildcards_len++] = p;
+		}
+	}
+
+	free(first);
+	free(wildcards);
+	return unreachable;
+}
+
+const char *check_reason_str(enum kanshi_check_reason reason) {
+	switch (reason) {
+	case KANSHI_CHECK_REACHABLE:
+		return "reachable";
+	case KANSHI_CHECK_DUPLICATE:
+		return "duplicate";
+	case KANSHI_CHECK_SHADOWED:
+		return "shadowed";
+	case KANSHI_CHECK_TOO_MANY_OUTPUTS:
+		return "too-many-outputs";
+	}
+	return "unknown";
+}
+
+void drop_unreachable_profiles(struct kanshi_compiled_config *compiled,
+		const struct kanshi_check_result *results) {
+	size_t len = 0;
+	for (size_t p = 0; p < compiled->profiles_len; p++) {
+		if (results[p].reason == KANSHI_CHECK_REACHABLE) {
+			compiled->profiles[len++] = compiled->profiles[p];
+		}
+	}
+	compiled->profiles_len = len;
+}
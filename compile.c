@@ -0,0 +1,129 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <string.h>
+
+#include "compile.h"
+#include "config.h"
+
+static uint32_t hash_name(const char *name) {
+	// FNV-1a
+	uint32_t hash = 2166136261u;
+	for (const unsigned char *c = (const unsigned char *)name; *c; c++) {
+		hash = (hash ^ *c) * 16777619u;
+	}
+	return hash;
+}
+
+static size_t find_slot(const struct kanshi_compiled_config *compiled,
+		const char *name) {
+	size_t mask = compiled->names_cap - 1;
+	size_t slot = hash_name(name) & mask;
+	while (compiled->names[slot] != NULL &&
+			strcmp(compiled->names[slot], name) != 0) {
+		slot = (slot + 1) & mask;
+	}
+	return slot;
+}
+
+uint32_t compiled_config_lookup(const struct kanshi_compiled_config *compiled,
+		const char *name) {
+	size_t slot = find_slot(compiled, name);
+	return compiled->names[slot] != NULL ?
+		compiled->ids[slot] : COMPILED_ID_NONE;
+}
+
+static uint32_t intern(struct kanshi_compiled_config *compiled,
+		const char *name) {
+	size_t slot = find_slot(compiled, name);
+	if (compiled->names[slot] == NULL) {
+		compiled->names[slot] = name;
+		compiled->ids[slot] = ++compiled->names_len;
+	}
+	return compiled->ids[slot];
+}
+
+static void compile_output(struct kanshi_compiled_config *compiled,
+		struct kanshi_profile_output *output) {
+	struct kanshi_compiled_output *compiled_output =
+		&compiled->outputs[compiled->outputs_len++];
+	compiled_output->output = output;
+	compiled_output->fields = output->fields;
+	if (strcmp(output->name, "*") == 0) {
+		compiled_output->criterion = KANSHI_CRITERION_WILDCARD;
+		compiled_output->id = COMPILED_ID_NONE;
+	} else if (output->pattern != NULL) {
+		compiled_output->criterion = KANSHI_CRITERION_PATTERN;
+		compiled_output->id = COMPILED_ID_NONE;
+	} else {
+		compiled_output->criterion = strchr(output->name, ' ') != NULL ?
+			KANSHI_CRITERION_IDENTIFIER : KANSHI_CRITERION_NAME;
+		compiled_output->id = intern(compiled, output->name);
+	}
+}
+
+bool compile_config(struct kanshi_config *config) {
+	struct kanshi_compiled_config *compiled = calloc(1, sizeof(*compiled));
+	if (compiled == NULL) {
+		return false;
+	}
+
+	size_t profiles_len = 0, outputs_len = 0;
+	struct kanshi_profile *profile;
+	wl_list_for_each(profile, &config->profiles, link) {
+		profiles_len++;
+		outputs_len += wl_list_length(&profile->outputs);
+	}
+
+	// Keep the name table at most half full
+	compiled->names_cap = 16;
+	while (compiled->names_cap < 2 * outputs_len) {
+		compiled->names_cap *= 2;
+	}
+	compiled->profiles = calloc(profiles_len + 1, sizeof(*compiled->profiles));
+	compiled->outputs = calloc(outputs_len + 1, sizeof(*compiled->outputs));
+	compiled->names = calloc(compiled->names_cap, sizeof(*compiled->names));
+	compiled->ids = calloc(compiled->names_cap, sizeof(*compiled->ids));
+	if (compiled->profiles == NULL || compiled->outputs == NULL ||
+			compiled->names == NULL || compiled->ids == NULL) {
+		destroy_compiled_config(compiled);
+		return false;
+	}
+
+	wl_list_for_each(profile, &config->profiles, link) {
+		struct kanshi_compiled_profile *compiled_profile =
+			&compiled->profiles[compiled->profiles_len++];
+		compiled_profile->profile = profile;
+		compiled_profile->unlisted = profile->unlisted;
+		compiled_profile->outputs_offset = compiled->outputs_len;
+
+		for (int pass = 0; pass < 2; pass++) {
+			bool optional = pass == 1;
+			struct kanshi_profile_output *output;
+			wl_list_for_each(output, &profile->outputs, link) {
+				if (output->optional == optional) {
+					compile_output(compiled, output);
+				}
+			}
+			if (!optional) {
+				compiled_profile->required_len =
+					compiled->outputs_len - compiled_profile->outputs_offset;
+			}
+		}
+		compiled_profile->outputs_len =
+			compiled->outputs_len - compiled_profile->outputs_offset;
+	}
+
+	config->compiled = compiled;
+	return true;
+}
+
+void destroy_compiled_config(struct kanshi_compiled_config *compiled) {
+	if (compiled == NULL) {
+		return;
+	}
+	free(compiled->profiles);
+	free(compiled->outputs);
+	free(compiled->names);
+	free(compiled->ids);
+	free(compiled);
+}
@@ -1,11 +1,14 @@
 #define _POSIX_C_SOURCE 200809L
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <limits.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/param.h>
+#include <time.h>
 #include <varlink.h>
 
 #include "ipc.h"
@@ -15,7 +18,13 @@ static void usage(void) {
 		"\n"
 		"Commands:\n"
 		"  reload            Reload the configuration file\n"
-		"  switch <profile>  Switch to another profile\n");
+		"  switch <profile>  Switch to another profile\n"
+		"  status            Show the current profile and outputs\n"
+		"  list              List the profiles of the configuration file\n"
+		"  monitor           Print profile, output and config events\n"
+		"  stats             Print daemon statistics\n"
+		"  wait [profile] [--timeout <seconds>]\n"
+		"                    Wait until a profile is applied\n");
 }
 
 static long handle_call_done(VarlinkConnection *connection, const char *error,
@@ -35,6 +44,193 @@ static long handle_call_done(VarlinkConnection *connection, const char *error,
 	return varlink_connection_close(connection);
 }
 
+static void print_mode(VarlinkObject *mode) {
+	int64_t width = 0, height = 0, refresh = 0;
+	varlink_object_get_int(mode, "width", &width);
+	varlink_object_get_int(mode, "height", &height);
+	varlink_object_get_int(mode, "refresh", &refresh);
+	printf("%" PRId64 "x%" PRId64, width, height);
+	if (refresh > 0) {
+		printf(" @ %" PRId64 ".%03" PRId64 " Hz", refresh / 1000, refresh % 1000);
+	}
+}
+
+static void print_head(VarlinkObject *head) {
+	const char *name = NULL, *description = NULL;
+	varlink_object_get_string(head, "name", &name);
+	varlink_object_get_string(head, "description", &description);
+	printf("%s", name);
+	if (description != NULL) {
+		printf(" \"%s\"", description);
+	}
+	printf("\n");
+
+	bool enabled = false, damped = false;
+	varlink_object_get_bool(head, "enabled", &enabled);
+	varlink_object_get_bool(head, "damped", &damped);
+	printf("  Enabled: %s\n", enabled ? "yes" : "no");
+	if (damped) {
+		printf("  Damped: yes\n");
+	}
+	if (!enabled) {
+		return;
+	}
+
+	VarlinkObject *mode = NULL;
+	if (varlink_object_get_object(head, "current_mode", &mode) == 0) {
+		printf("  Mode: ");
+		print_mode(mode);
+		printf("\n");
+	}
+
+	int64_t x = 0, y = 0, transform = 0;
+	double scale = 1;
+	bool adaptive_sync = false;
+	varlink_object_get_int(head, "x", &x);
+	varlink_object_get_int(head, "y", &y);
+	varlink_object_get_int(head, "transform", &transform);
+	varlink_object_get_float(head, "scale", &scale);
+	varlink_object_get_bool(head, "adaptive_sync", &adaptive_sync);
+	printf("  Position: %" PRId64 ",%" PRId64 "\n", x, y);
+	printf("  Transform: %" PRId64 "\n", transform);
+	printf("  Scale: %f\n", scale);
+	printf("  Adaptive sync: %s\n", adaptive_sync ? "enabled" : "disabled");
+}
+
+static long handle_get_state_done(VarlinkConnection *connection,
+		const char *error, VarlinkObject *parameters, uint64_t flags,
+		void *userdata) {
+	if (error != NULL) {
+		return handle_call_done(connection, error, parameters, flags, userdata);
+	}
+
+	const char *current = NULL, *pending = NULL;
+	varlink_object_get_string(parameters, "current_profile", &current);
+	varlink_object_get_string(parameters, "pending_profile", &pending);
+	printf("Current profile: %s\n", current != NULL ? current : "(none)");
+	if (pending != NULL) {
+		printf("Pending profile: %s\n", pending);
+	}
+
+	VarlinkArray *heads = NULL;
+	if (varlink_object_get_array(parameters, "heads", &heads) == 0) {
+		unsigned long n = varlink_array_get_n(heads);
+		for (unsigned long i = 0; i < n; i++) {
+			VarlinkObject *head = NULL;
+			if (varlink_array_get_object(heads, i, &head) == 0) {
+				printf("\n");
+				print_head(head);
+			}
+		}
+	}
+
+	return varlink_connection_close(connection);
+}
+
+static long handle_list_profiles_done(VarlinkConnection *connection,
+		const char *error, VarlinkObject *parameters, uint64_t flags,
+		void *userdata) {
+	if (error != NULL) {
+		return handle_call_done(connection, error, parameters, flags, userdata);
+	}
+
+	VarlinkArray *profiles = NULL;
+	if (varlink_object_get_array(parameters, "profiles", &profiles) == 0) {
+		unsigned long n = varlink_array_get_n(profiles);
+		for (unsigned long i = 0; i < n; i++) {
+			const char *name = NULL;
+			if (varlink_array_get_string(profiles, i, &name) == 0) {
+				printf("%s\n", name);
+			}
+		}
+	}
+
+	return varlink_connection_close(connection);
+}
+
+static long handle_monitor_event(VarlinkConnection *connection,
+		const char *error, VarlinkObject *parameters, uint64_t flags,
+		void *userdata) {
+	if (error != NULL) {
+		return handle_call_done(connection, error, parameters, flags, userdata);
+	}
+
+	const char *event = NULL, *profile = NULL, *head = NULL;
+	varlink_object_get_string(parameters, "event", &event);
+	varlink_object_get_string(parameters, "profile", &profile);
+	varlink_object_get_string(parameters, "head", &head);
+	printf("%s", event);
+	if (profile != NULL) {
+		printf(" %s", profile);
+	}
+	if (head != NULL) {
+		printf(" %s", head);
+	}
+	printf("\n");
+	fflush(stdout);
+
+	if (!(flags & VARLINK_REPLY_CONTINUES)) {
+		return varlink_connection_close(connection);
+	}
+	return 0;
+}
+
+static long handle_wait_done(VarlinkConnection *connection, const char *error,
+		VarlinkObject *parameters, uint64_t flags, void *userdata) {
+	if (error != NULL) {
+		return handle_call_done(connection, error, parameters, flags, userdata);
+	}
+
+	const char *profile = NULL;
+	varlink_object_get_string(parameters, "profile", &profile);
+	printf("%s\n", profile);
+	return varlink_connection_close(connection);
+}
+
+static long handle_get_stats_done(VarlinkConnection *connection,
+		const char *error, VarlinkObject *parameters, uint64_t flags,
+		void *userdata) {
+	if (error != NULL) {
+		return handle_call_done(connection, error, parameters, flags, userdata);
+	}
+
+	static const char *const fields[] = {
+		"done_events",
+		"matches",
+		"match_cache_hits",
+		"applies",
+		"applies_succeeded",
+		"applies_failed",
+		"applies_cancelled",
+		"apply_timeouts",
+		"apply_retries_exhausted",
+		"restores",
+		"restore_failures",
+		"recovery_us",
+		"recovery_max_us",
+		"commands",
+		"command_failures",
+		"reloads",
+		"reload_failures",
+		"damped_heads",
+		"parse_time_us",
+		"apply_latency_samples",
+		"apply_latency_p50_us",
+		"apply_latency_p90_us",
+		"apply_latency_p99_us",
+		"apply_latency_max_us",
+		"pool_mallocs",
+		"pool_reuses",
+	};
+	for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+		int64_t value = 0;
+		varlink_object_get_int(parameters, fields[i], &value);
+		printf("%s: %" PRId64 "\n", fields[i], value);
+	}
+
+	return varlink_connection_close(connection);
+}
+
 static int set_blocking(int fd) {
 	int flags = fcntl(fd, F_GETFL);
 	if (flags == -1) {
@@ -49,14 +245,37 @@ static int set_blocking(int fd) {
 	return 0;
 }
 
-static int wait_for_event(VarlinkConnection *connection) {
+static int64_t get_time_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// A negative timeout waits forever
+static int wait_for_event(VarlinkConnection *connection, int timeout_ms) {
 	int fd = varlink_connection_get_fd(connection);
 	if (set_blocking(fd) != 0) {
 		return -1;
 	}
 
+	int64_t deadline = get_time_ms() + timeout_ms;
 	while (!varlink_connection_is_closed(connection)) {
 		uint32_t events = varlink_connection_get_events(connection);
+		if (timeout_ms >= 0) {
+			int64_t remaining = deadline - get_time_ms();
+			// epoll and poll event bits are the same
+			struct pollfd pfd = { .fd = fd, .events = events };
+			int n = poll(&pfd, 1, remaining > 0 ? remaining : 0);
+			if (n < 0 && errno != EINTR) {
+				fprintf(stderr, "poll failed: %s\n", strerror(errno));
+				return -1;
+			} else if (n == 0) {
+				fprintf(stderr, "Timed out\n");
+				return -1;
+			} else if (n < 0) {
+				continue;
+			}
+		}
 		long result = varlink_connection_process_events(connection, events);
 		if (result != 0) {
 			fprintf(stderr, "varlink_connection_process_events failed: %s\n",
@@ -89,6 +308,7 @@ int main(int argc, char *argv[]) {
 	}
 
 	const char *command = argv[1];
+	int timeout_ms = -1;
 	long ret;
 	if (strcmp(command, "reload") == 0) {
 		ret = varlink_connection_call(connection,
@@ -106,6 +326,48 @@ int main(int argc, char *argv[]) {
 		ret = varlink_connection_call(connection,
 			"fr.emersion.kanshi.Switch", params, 0, handle_call_done, NULL);
 		varlink_object_unref(params);
+	} else if (strcmp(command, "status") == 0) {
+		ret = varlink_connection_call(connection,
+			"fr.emersion.kanshi.GetState", NULL, 0, handle_get_state_done, NULL);
+	} else if (strcmp(command, "list") == 0) {
+		ret = varlink_connection_call(connection,
+			"fr.emersion.kanshi.ListProfiles", NULL, 0,
+			handle_list_profiles_done, NULL);
+	} else if (strcmp(command, "wait") == 0) {
+		const char *profile = NULL;
+		for (int i = 2; i < argc; i++) {
+			if (strcmp(argv[i], "--timeout") == 0 && i + 1 < argc) {
+				char *end;
+				double timeout = strtod(argv[++i], &end);
+				if (*end != '\0' || timeout < 0 || timeout > INT_MAX / 1000) {
+					fprintf(stderr, "invalid timeout: %s\n", argv[i]);
+					return EXIT_FAILURE;
+				}
+				timeout_ms = timeout * 1000;
+			} else if (profile == NULL && argv[i][0] != '-') {
+				profile = argv[i];
+			} else {
+				usage();
+				return EXIT_FAILURE;
+			}
+		}
+
+		VarlinkObject *params = NULL;
+		varlink_object_new(&params);
+		if (profile != NULL) {
+			varlink_object_set_string(params, "profile", profile);
+		}
+		ret = varlink_connection_call(connection,
+			"fr.emersion.kanshi.Wait", params, 0, handle_wait_done, NULL);
+		varlink_object_unref(params);
+	} else if (strcmp(command, "stats") == 0) {
+		ret = varlink_connection_call(connection,
+			"fr.emersion.kanshi.GetStats", NULL, 0, handle_get_stats_done,
+			NULL);
+	} else if (strcmp(command, "monitor") == 0) {
+		ret = varlink_connection_call(connection,
+			"fr.emersion.kanshi.Monitor", NULL, VARLINK_CALL_MORE,
+			handle_monitor_event, NULL);
 	} else {
 		fprintf(stderr, "invalid command: %s\n", argv[1]);
 		usage();
@@ -117,5 +379,5 @@ int main(int argc, char *argv[]) {
 		return EXIT_FAILURE;
 	}
 
-	return wait_for_event(connection);
+	return wait_for_event(connection, timeout_ms);
 }
@@ -0,0 +1,163 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "damping.h"
+#include "ipc.h"
+#include "kanshi.h"
+#include "log.h"
+#include "match.h"
+
+// Connection history of a connector, kept while it's unplugged
+struct kanshi_flap {
+	struct wl_list link; // kanshi_state.flaps
+	char *name;
+	// Ring buffer of the last toggle times
+	uint64_t toggles_ms[DAMPING_MAX_TOGGLES + 1];
+	size_t toggles_len, toggles_index;
+	bool damped;
+	struct kanshi_timer timer;
+};
+
+static uint64_t get_time_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static struct kanshi_head *find_head(struct kanshi_state *state,
+		const char *name) {
+	struct kanshi_head *head;
+	wl_list_for_each(head, &state->heads, link) {
+		if (head->name != NULL && strcmp(head->name, name) == 0) {
+			return head;
+		}
+	}
+	return NULL;
+}
+
+static void handle_flap_timer(struct kanshi_state *state, void *data) {
+	struct kanshi_flap *flap = data;
+	flap->damped = false;
+	flap->toggles_len = 0;
+	kanshi_log(KANSHI_LOG_INFO, "output is stable again output=\"%s\"",
+		flap->name);
+
+	struct kanshi_head *head = find_head(state, flap->name);
+	if (head != NULL) {
+		head->damped = false;
+		matcher_add_head(state->matcher, head);
+	}
+#if KANSHI_HAS_VARLINK
+	kanshi_ipc_send_event(state, KANSHI_IPC_HEAD_UNDAMPED, flap->name);
+#endif
+	if (head != NULL) {
+		kanshi_rematch(state);
+	}
+}
+
+static void destroy_flap(struct kanshi_flap *flap) {
+	kanshi_timer_disarm(&flap->timer);
+	wl_list_remove(&flap->link);
+	free(flap->name);
+	free(flap);
+}
+
+// Whether all the toggles are too old to damp the connector again, in which
+// case forgetting them changes nothing
+static bool is_stale(struct kanshi_flap *flap, uint64_t now) {
+	if (flap->damped) {
+		return false;
+	} else if (flap->toggles_len == 0) {
+		return true;
+	}
+	size_t cap = sizeof(flap->toggles_ms) / sizeof(flap->toggles_ms[0]);
+	uint64_t last_ms = flap->toggles_ms[(flap->toggles_index + cap - 1) % cap];
+	return now - last_ms > DAMPING_WINDOW_MS;
+}
+
+static struct kanshi_flap *get_flap(struct kanshi_state *state,
+		const char *name) {
+	struct kanshi_flap *flap, *tmp;
+	wl_list_for_each(flap, &state->flaps, link) {
+		if (strcmp(flap->name, name) == 0) {
+			return flap;
+		}
+	}
+
+	// Connector names may never come back, don't let their histories pile up
+	uint64_t now = get_time_ms();
+	wl_list_for_each_safe(flap, tmp, &state->flaps, link) {
+		if (is_stale(flap, now)) {
+			destroy_flap(flap);
+		}
+	}
+
+	flap = calloc(1, sizeof(*flap));
+	if (flap == NULL) {
+		return NULL;
+	}
+	flap->name = strdup(name);
+	if (flap->name == NULL) {
+		free(flap);
+		return NULL;
+	}
+	kanshi_timer_init(&flap->timer, handle_flap_timer, flap);
+	wl_list_insert(&state->flaps, &flap->link);
+	return flap;
+}
+
+// Returns whether the connector is damped
+static bool toggle(struct kanshi_state *state, const char *name) {
+	if (name == NULL) {
+		return false;
+	}
+	struct kanshi_flap *flap = get_flap(state, name);
+	if (flap == NULL) {
+		return false;
+	}
+
+	uint64_t now = get_time_ms();
+	size_t cap = sizeof(flap->toggles_ms) / sizeof(flap->toggles_ms[0]);
+	flap->toggles_ms[flap->toggles_index] = now;
+	flap->toggles_index = (flap->toggles_index + 1) % cap;
+	if (flap->toggles_len < cap) {
+		flap->toggles_len++;
+	}
+
+	// Once the buffer is full, the next slot holds the oldest toggle
+	if (!flap->damped && flap->toggles_len == cap &&
+			now - flap->toggles_ms[flap->toggles_index] <= DAMPING_WINDOW_MS) {
+		flap->damped = true;
+		state->stats.damped_heads++;
+		kanshi_log(KANSHI_LOG_INFO, "output is flapping, ignoring it until it "
+			"is stable output=\"%s\" hold_ms=%d", name, DAMPING_HOLD_MS);
+#if KANSHI_HAS_VARLINK
+		kanshi_ipc_send_event(state, KANSHI_IPC_HEAD_DAMPED, name);
+#endif
+	}
+	if (flap->damped) {
+		kanshi_timer_arm(state, &flap->timer, DAMPING_HOLD_MS);
+	}
+	return flap->damped;
+}
+
+void kanshi_damping_head_added(struct kanshi_state *state,
+		struct kanshi_head *head) {
+	head->damped = toggle(state, head->name);
+}
+
+void kanshi_damping_head_removed(struct kanshi_state *state,
+		struct kanshi_head *head) {
+	toggle(state, head->name);
+}
+
+void kanshi_free_damping(struct kanshi_state *state) {
+	struct kanshi_flap *flap, *tmp;
+	wl_list_for_each_safe(flap, tmp, &state->flaps, link) {
+		destroy_flap(flap);
+	}
+}
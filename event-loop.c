@@ -1,14 +1,18 @@
 #define _POSIX_C_SOURCE 200809L
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <poll.h>
 #include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "kanshi.h"
+#include "log.h"
 
 #if KANSHI_HAS_VARLINK
 #include <varlink.h>
@@ -38,6 +42,123 @@ static int set_pipe_flags(int fd) {
 	return 0;
 }
 
+#define RECONNECT_MIN_DELAY_MS 100
+#define RECONNECT_MAX_DELAY_MS 5000
+
+static uint64_t get_time_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void kanshi_timer_init(struct kanshi_timer *timer, kanshi_timer_func func,
+		void *data) {
+	wl_list_init(&timer->link);
+	timer->func = func;
+	timer->data = data;
+}
+
+void kanshi_timer_arm(struct kanshi_state *state, struct kanshi_timer *timer,
+		int delay_ms) {
+	wl_list_remove(&timer->link);
+	timer->deadline_ms = get_time_ms() + delay_ms;
+	wl_list_insert(&state->timers, &timer->link);
+}
+
+void kanshi_timer_disarm(struct kanshi_timer *timer) {
+	wl_list_remove(&timer->link);
+	wl_list_init(&timer->link);
+}
+
+bool kanshi_timer_armed(const struct kanshi_timer *timer) {
+	return !wl_list_empty(&timer->link);
+}
+
+// Returns the poll() timeout until the next timer expires
+static int timers_timeout(struct kanshi_state *state) {
+	if (wl_list_empty(&state->timers)) {
+		return -1;
+	}
+	uint64_t now = get_time_ms();
+	uint64_t next = UINT64_MAX;
+	struct kanshi_timer *timer;
+	wl_list_for_each(timer, &state->timers, link) {
+		if (timer->deadline_ms < next) {
+			next = timer->deadline_ms;
+		}
+	}
+	if (next <= now) {
+		return 0;
+	}
+	return next - now > INT_MAX ? INT_MAX : (int)(next - now);
+}
+
+static void run_timers(struct kanshi_state *state) {
+	uint64_t now = get_time_ms();
+	// Callbacks may arm and disarm timers, start over after each one
+	bool expired = true;
+	while (expired) {
+		expired = false;
+		struct kanshi_timer *timer;
+		wl_list_for_each(timer, &state->timers, link) {
+			if (timer->deadline_ms <= now) {
+				kanshi_timer_disarm(timer);
+				timer->func(state, timer->data);
+				expired = true;
+				break;
+			}
+		}
+	}
+}
+
+static void handle_reconnect_timer(struct kanshi_state *state, void *data) {
+	if (kanshi_connect(state)) {
+		kanshi_log(KANSHI_LOG_INFO, "reconnected to the compositor");
+		return;
+	}
+	state->reconnect_delay_ms *= 2;
+	if (state->reconnect_delay_ms > RECONNECT_MAX_DELAY_MS) {
+		state->reconnect_delay_ms = RECONNECT_MAX_DELAY_MS;
+	}
+	kanshi_timer_arm(state, &state->reconnect_timer,
+		state->reconnect_delay_ms);
+}
+
+// Keeps the config, IPC service and caches, and reconnects with exponential
+// backoff
+static void handle_connection_lost(struct kanshi_state *state) {
+	kanshi_log(KANSHI_LOG_ERROR, "lost connection to the compositor, "
+		"reconnecting");
+	kanshi_disconnect(state);
+	state->reconnect_delay_ms = RECONNECT_MIN_DELAY_MS;
+	kanshi_timer_arm(state, &state->reconnect_timer,
+		state->reconnect_delay_ms);
+}
+
+// Returns -1 if the connection is lost
+static int prepare_read(struct wl_display *display) {
+	while (wl_display_prepare_read(display) != 0) {
+		if (wl_display_dispatch_pending(display) == -1) {
+			return -1;
+		}
+	}
+
+	int ret;
+	while (true) {
+		ret = wl_display_flush(display);
+		if (ret != -1 || errno != EAGAIN) {
+			break;
+		}
+	}
+
+	// EPIPE is reported by wl_display_read_events()
+	if (ret < 0 && errno != EPIPE) {
+		wl_display_cancel_read(display);
+		return -1;
+	}
+	return 0;
+}
+
 static int signal_pipefds[2];
 
 static void signal_handler(int signum) {
@@ -76,8 +197,9 @@ int kanshi_main_loop(struct kanshi_state *state) {
 	sigaction(SIGTERM, &action, NULL);
 	sigaction(SIGHUP, &action, NULL);
 
+	kanshi_timer_init(&state->reconnect_timer, handle_reconnect_timer, NULL);
+
 	struct pollfd readfds[FD_COUNT] = {0};
-	readfds[FD_WAYLAND].fd = wl_display_get_fd(state->display);
 	readfds[FD_WAYLAND].events = POLLIN;
 	readfds[FD_SIGNAL].fd = signal_pipefds[0];
 	readfds[FD_SIGNAL].events = POLLIN;
@@ -87,43 +209,45 @@ int kanshi_main_loop(struct kanshi_state *state) {
 #endif
 
 	while (state->running) {
-		while (wl_display_prepare_read(state->display) != 0) {
-			if (wl_display_dispatch_pending(state->display) == -1) {
-				return EXIT_FAILURE;
-			}
+		struct wl_display *display = state->display;
+		if (display != NULL && prepare_read(display) != 0) {
+			handle_connection_lost(state);
+			continue;
 		}
+		// poll() ignores negative fds
+		readfds[FD_WAYLAND].fd =
+			display != NULL ? wl_display_get_fd(display) : -1;
 
-		int ret;
-
-		while (true) {
-			ret = wl_display_flush(state->display);
-			if (ret != -1 || errno != EAGAIN) {
-				break;
-			}
-		}
-
-		if (ret < 0 && errno != EPIPE) {
-			goto read_error;
+		// Messages are written out once per loop iteration, wake up to
+		// report suppressed messages
+		kanshi_log_flush();
+		int timeout = timers_timeout(state);
+		int log_timeout = kanshi_log_timeout();
+		if (log_timeout >= 0 && (timeout < 0 || log_timeout < timeout)) {
+			timeout = log_timeout;
 		}
 
+		int ret;
 		do {
-			ret = poll(readfds, sizeof(readfds) / sizeof(readfds[0]), -1);
+			ret = poll(readfds, sizeof(readfds) / sizeof(readfds[0]),
+				timeout);
 		} while (ret == -1 && errno == EINTR);
 		/* will only be -1 if errno wasn't EINTR */
 		if (ret == -1) {
 			goto read_error;
 		}
 
-		if (wl_display_read_events(state->display) == -1) {
-			return EXIT_FAILURE;
+		if (display != NULL && wl_display_read_events(display) == -1) {
+			handle_connection_lost(state);
+			display = NULL;
 		}
 
 #if KANSHI_HAS_VARLINK
 		if (readfds[FD_VARLINK].revents & POLLIN) {
 			long result = varlink_service_process_events(state->service);
 			if (result != 0) {
-				fprintf(stderr, "varlink_service_process_events failed: %s\n",
-						varlink_error_string(-result));
+				kanshi_log(KANSHI_LOG_ERROR, "varlink_service_process_events "
+					"failed error=\"%s\"", varlink_error_string(-result));
 				return EXIT_FAILURE;
 			}
 		}
@@ -159,14 +283,20 @@ int kanshi_main_loop(struct kanshi_state *state) {
 			}
 		}
 
-		if (wl_display_dispatch_pending(state->display) == -1) {
-			return EXIT_FAILURE;
+		run_timers(state);
+		// Timers may have reconnected
+		if (display != NULL && state->display == display &&
+				wl_display_dispatch_pending(display) == -1) {
+			handle_connection_lost(state);
 		}
 	}
 
 	return EXIT_SUCCESS;
 
 read_error:
-	wl_display_cancel_read(state->display);
+	perror("poll failed");
+	if (state->display != NULL) {
+		wl_display_cancel_read(state->display);
+	}
 	return EXIT_FAILURE;
 }
@@ -0,0 +1,38 @@
+#ifndef KANSHI_CHECK_H
+#define KANSHI_CHECK_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "compile.h"
+
+// Why a profile can never be matched
+enum kanshi_check_reason {
+	KANSHI_CHECK_REACHABLE,
+	// Same criteria as an earlier profile
+	KANSHI_CHECK_DUPLICATE,
+	// An earlier profile only has wildcards and matches any number of heads
+	// this one can match
+	KANSHI_CHECK_SHADOWED,
+	// Requires more than HEADS_MAX heads
+	KANSHI_CHECK_TOO_MANY_OUTPUTS,
+};
+
+struct kanshi_check_result {
+	enum kanshi_check_reason reason;
+	uint32_t shadowed_by; // compiled profile index, if duplicate or shadowed
+};
+
+// Finds the profiles which can never be matched because an earlier one always
+// matches first. The checks are conservative: profiles which aren't reported
+// may still be unreachable. Fills a result per compiled profile and returns
+// the number of unreachable profiles, or -1 on error.
+ssize_t check_compiled_config(const struct kanshi_compiled_config *compiled,
+	struct kanshi_check_result *results);
+const char *check_reason_str(enum kanshi_check_reason reason);
+// Removes the unreachable profiles from the compiled config, the profiles
+// stay in the config
+void drop_unreachable_profiles(struct kanshi_compiled_config *compiled,
+	const struct kanshi_check_result *results);
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef KANSHI_COMPILE_H
+#define KANSHI_COMPILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct kanshi_config;
+struct kanshi_profile;
+struct kanshi_profile_output;
+
+// Interned output names start at 1, 0 is never the ID of a name
+#define COMPILED_ID_NONE 0
+
+enum kanshi_compiled_criterion {
+	KANSHI_CRITERION_WILDCARD,
+	// Names without spaces can only match the head name, identifiers
+	// ("make model serial") contain spaces
+	KANSHI_CRITERION_NAME,
+	KANSHI_CRITERION_IDENTIFIER,
+	// Glob or regular expression, see kanshi_output_pattern
+	KANSHI_CRITERION_PATTERN,
+};
+
+struct kanshi_compiled_output {
+	uint32_t id; // interned name, COMPILED_ID_NONE for wildcards and patterns
+	uint32_t criterion; // enum kanshi_compiled_criterion
+	uint32_t fields; // enum kanshi_output_field
+	struct kanshi_profile_output *output;
+};
+
+struct kanshi_compiled_profile {
+	struct kanshi_profile *profile;
+	// Range in kanshi_compiled_config.outputs: the required outputs, then
+	// the optional ones, each in the same order as the profile outputs
+	uint32_t outputs_offset, outputs_len;
+	uint32_t required_len;
+	uint32_t unlisted; // enum kanshi_unlisted_policy
+};
+
+// Flat copy of the config used by the matcher, profiles in file order
+struct kanshi_compiled_config {
+	struct kanshi_compiled_profile *profiles;
+	size_t profiles_len;
+	struct kanshi_compiled_output *outputs;
+	size_t outputs_len;
+
+	// Open-addressing table of the interned names, the slot of a name holds
+	// its ID. Names point into the config.
+	const char **names;
+	uint32_t *ids;
+	size_t names_cap; // power of two
+	uint32_t names_len;
+};
+
+// Lowers the profiles of a parsed config into config->compiled
+bool compile_config(struct kanshi_config *config);
+void destroy_compiled_config(struct kanshi_compiled_config *compiled);
+// Returns the ID of an interned name, or COMPILED_ID_NONE
+uint32_t compiled_config_lookup(const struct kanshi_compiled_config *compiled,
+	const char *name);
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef KANSHI_CONFIG_H
 #define KANSHI_CONFIG_H
 
+#include <regex.h>
 #include <stdbool.h>
 #include <wayland-client.h>
 
@@ -13,8 +14,24 @@ enum kanshi_output_field {
 	KANSHI_OUTPUT_ADAPTIVE_SYNC = 1 << 5,
 };
 
+enum kanshi_pattern_type {
+	KANSHI_PATTERN_GLOB,
+	KANSHI_PATTERN_REGEX,
+};
+
+// Output criteria prefixed with "glob:" or "regex:", compiled by the parser
+struct kanshi_output_pattern {
+	enum kanshi_pattern_type type;
+	const char *glob; // points into the output name
+	regex_t regex; // anchored extended regular expression
+};
+
 struct kanshi_profile_output {
 	char *name;
+	struct kanshi_output_pattern *pattern; // NULL for other criteria
+	// Output definition or template output this one was copied from, which
+	// owns the name and pattern, NULL if this one owns them
+	const struct kanshi_profile_output *base;
 	unsigned int fields; // enum kanshi_output_field
 	struct wl_list link;
 
@@ -29,6 +46,8 @@ struct kanshi_profile_output {
 	float scale;
 	enum wl_output_transform transform;
 	bool adaptive_sync;
+
+	bool optional; // the profile also matches if no head matches this output
 };
 
 struct kanshi_profile_command {
@@ -36,16 +55,34 @@ struct kanshi_profile_command {
 	char *command;
 };
 
+// What to do with heads which don't match any output of a profile
+enum kanshi_unlisted_policy {
+	KANSHI_UNLISTED_NONE, // the profile doesn't match
+	KANSHI_UNLISTED_KEEP, // leave them in their current state
+	KANSHI_UNLISTED_DISABLE,
+	KANSHI_UNLISTED_AUTO, // enable them with their preferred mode
+};
+
 struct kanshi_profile {
 	struct wl_list link;
 	char *name;
-	// Wildcard outputs are stored at the end of the list
+	enum kanshi_unlisted_policy unlisted;
+	// Outputs with an exact name are stored first, then patterns, then
+	// wildcards
 	struct wl_list outputs;
 	struct wl_list commands;
 };
 
+struct kanshi_compiled_config;
+
 struct kanshi_config {
 	struct wl_list profiles;
+	// Top-level output definitions and profile templates, which profiles
+	// copy when parsed
+	struct wl_list outputs;
+	struct wl_list templates;
+	// Flat copy of the profiles used for matching, see compile.h
+	struct kanshi_compiled_config *compiled;
 };
 
 #endif
@@ -0,0 +1,19 @@
+#ifndef KANSHI_DAMPING_H
+#define KANSHI_DAMPING_H
+
+#include "kanshi.h"
+
+// A head which appears or disappears more than DAMPING_MAX_TOGGLES times within
+// DAMPING_WINDOW_MS is damped: it is left out of matching until it has been
+// stable for DAMPING_HOLD_MS
+#define DAMPING_MAX_TOGGLES 6
+#define DAMPING_WINDOW_MS 30000
+#define DAMPING_HOLD_MS 10000
+
+void kanshi_damping_head_added(struct kanshi_state *state,
+	struct kanshi_head *head);
+void kanshi_damping_head_removed(struct kanshi_state *state,
+	struct kanshi_head *head);
+void kanshi_free_damping(struct kanshi_state *state);
+
+#endif
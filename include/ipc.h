@@ -5,9 +5,25 @@
 
 #include "kanshi.h"
 
+enum kanshi_ipc_event {
+	KANSHI_IPC_PROFILE_APPLIED,
+	KANSHI_IPC_PROFILE_FAILED,
+	KANSHI_IPC_HEAD_ADDED,
+	KANSHI_IPC_HEAD_REMOVED,
+	KANSHI_IPC_HEAD_DAMPED,
+	KANSHI_IPC_HEAD_UNDAMPED,
+	KANSHI_IPC_CONFIG_RELOADED,
+};
+
 int kanshi_init_ipc(struct kanshi_state *state, int listen_fd);
 void kanshi_free_ipc(struct kanshi_state *state);
 
+// Send an event to Monitor subscribers. name is the profile or head name, or
+// NULL for KANSHI_IPC_CONFIG_RELOADED.
+void kanshi_ipc_send_event(struct kanshi_state *state,
+	enum kanshi_ipc_event event, const char *name);
+
 int get_ipc_address(char *address, size_t size);
+int get_status_path(char *path, size_t size);
 
 #endif
@@ -4,10 +4,18 @@
 #include <stdbool.h>
 #include <wayland-client.h>
 
+#include "pool.h"
+#include "stats.h"
+
+struct zwlr_output_configuration_v1;
 struct zwlr_output_manager_v1;
 
 struct kanshi_state;
 struct kanshi_head;
+struct kanshi_record;
+struct kanshi_record_head;
+struct kanshi_status_file;
+struct kanshi_layout;
 
 struct kanshi_mode {
 	struct kanshi_head *head;
@@ -19,6 +27,24 @@ struct kanshi_mode {
 	bool preferred;
 };
 
+// Profile output a profile configured a head with
+struct kanshi_head_assignment {
+	// false if the head was damped or not there yet when the profile was
+	// applied
+	bool configured;
+	struct kanshi_profile_output *output; // NULL if unlisted
+};
+
+// Output state as reported by the compositor
+struct kanshi_head_state {
+	bool enabled;
+	struct kanshi_mode *mode;
+	int32_t x, y;
+	enum wl_output_transform transform;
+	double scale;
+	bool adaptive_sync;
+};
+
 struct kanshi_head {
 	struct kanshi_state *state;
 	struct zwlr_output_head_v1 *wlr_head;
@@ -39,31 +65,93 @@ struct kanshi_head {
 	enum wl_output_transform transform;
 	double scale;
 	bool adaptive_sync;
+
+	bool announced; // whether a done event was received since creation
+	bool damped; // left out of matching, see damping.h
+	// Whether the head is counted by the incremental matcher, and its
+	// interned name and identifier, see match.h
+	bool counted;
+	uint32_t name_id, identifier_id;
+	// State before the last apply, restored if the configuration fails
+	bool has_last_good;
+	struct kanshi_head_state last_good;
+	// How the current and the last sent profile configured the head, for
+	// profiles whose outputs can be assigned to heads in several ways
+	struct kanshi_head_assignment current_assignment, pending_assignment;
+	struct kanshi_record_head *record;
+};
+
+typedef void (*kanshi_timer_func)(struct kanshi_state *state, void *data);
+
+struct kanshi_timer {
+	struct wl_list link; // kanshi_state.timers, or empty if disarmed
+	uint64_t deadline_ms; // CLOCK_MONOTONIC
+	kanshi_timer_func func;
+	void *data;
 };
 
 struct kanshi_state {
 	bool running;
-	struct wl_display *display;
+	struct wl_display *display; // NULL while disconnected
+	struct wl_registry *registry;
 	struct zwlr_output_manager_v1 *output_manager;
 #if KANSHI_HAS_VARLINK
 	struct VarlinkService *service;
+	struct wl_list monitors;
+	struct wl_list waiters;
 #endif
 
 	struct kanshi_config *config;
+	struct kanshi_matcher *matcher; // built from config
+	struct kanshi_match_pool *match_pool; // may be NULL
 	const char *config_arg;
+	bool drop_unreachable; // from the compiled config, see check.h
+	struct kanshi_record *record;
+	struct kanshi_status_file *status;
+	struct kanshi_layout *layout; // saved layout, until the first done
 
 	struct wl_list heads;
 	uint32_t serial;
 	struct kanshi_profile *current_profile;
 	struct kanshi_profile *pending_profile;
+	struct wl_list pending_configs; // kanshi_pending_profile.link
+
+	struct wl_list timers; // kanshi_timer.link
+	struct wl_list flaps; // kanshi_flap.link
+	struct kanshi_timer reconnect_timer;
+	int reconnect_delay_ms;
+	// Retries after cancelled configurations
+	struct kanshi_timer retry_timer;
+	int apply_retries;
+	uint32_t retry_serial;
+	struct kanshi_restore *restore; // in flight, or NULL
+	// Last profile the compositor failed to apply, and the number of heads
+	// then. Matching doesn't apply it again to the same heads assigned to
+	// the same outputs, see kanshi_head.pending_assignment.
+	struct kanshi_profile *failed_profile;
+	int failed_heads_len;
+
+	struct kanshi_stats stats;
+	// Heads, modes and pending profiles, the stats have their counters
+	struct kanshi_pool pools[KANSHI_POOL_COUNT];
+};
+
+// Configuration putting heads back to their state before a failed apply
+struct kanshi_restore {
+	struct zwlr_output_configuration_v1 *config;
+	uint64_t start_ns; // time the failure was received
 };
 
 typedef void (*kanshi_apply_done_func)(void *data, bool success);
 
 struct kanshi_pending_profile {
+	struct wl_list link;
+	struct zwlr_output_configuration_v1 *config;
 	uint32_t serial;
 	struct kanshi_state *state;
 	struct kanshi_profile *profile;
+	uint64_t apply_ns; // time the configuration was sent
+	struct kanshi_timer watchdog;
 
 	kanshi_apply_done_func callback;
 	void *callback_data;
@@ -73,6 +161,18 @@ bool kanshi_reload_config(struct kanshi_state *state,
 	kanshi_apply_done_func callback, void *data);
 bool kanshi_switch(struct kanshi_state *state, struct kanshi_profile *profile,
 	kanshi_apply_done_func callback, void *data);
+// Matches the current heads again and applies the result
+bool kanshi_rematch(struct kanshi_state *state);
+
+bool kanshi_connect(struct kanshi_state *state);
+void kanshi_disconnect(struct kanshi_state *state);
+
+void kanshi_timer_init(struct kanshi_timer *timer, kanshi_timer_func func,
+	void *data);
+void kanshi_timer_arm(struct kanshi_state *state, struct kanshi_timer *timer,
+	int delay_ms);
+void kanshi_timer_disarm(struct kanshi_timer *timer);
+bool kanshi_timer_armed(const struct kanshi_timer *timer);
 
 int kanshi_main_loop(struct kanshi_state *state);
 
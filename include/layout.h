@@ -0,0 +1,20 @@
+#ifndef KANSHI_LAYOUT_H
+#define KANSHI_LAYOUT_H
+
+#include <stdbool.h>
+
+#include "kanshi.h"
+#include "match.h"
+
+// The last applied layout is saved to $XDG_STATE_HOME/kanshi/layout, so that
+// kanshi can apply it on startup without running the matcher
+int kanshi_load_layout(struct kanshi_state *state);
+void kanshi_free_layout(struct kanshi_state *state);
+void kanshi_save_layout(struct kanshi_state *state,
+	struct kanshi_profile *profile);
+// Returns the saved profile if the saved layout is still valid for the current
+// heads and config, and consumes it
+struct kanshi_profile *kanshi_use_layout(struct kanshi_state *state,
+	struct kanshi_profile_output *matches[static HEADS_MAX]);
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef LIBKANSHI_H
+#define LIBKANSHI_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The kanshi engine, for programs which want to match profiles in-process:
+// it parses configs, picks the profile matching a set of heads and plans the
+// configuration of each head. It doesn't talk to a compositor and doesn't run
+// the profile commands, callers apply the plans and run the commands.
+
+// Largest number of heads which can be matched at once
+#define LIBKANSHI_HEADS_MAX 64
+
+struct libkanshi_config;
+
+// Parses a config from a buffer, which doesn't need to be NUL-terminated.
+// include directives are rejected. Returns NULL on error, the parse errors are
+// printed to stderr.
+struct libkanshi_config *libkanshi_config_parse(const char *text, size_t len);
+// Parses a config file and the files it includes
+struct libkanshi_config *libkanshi_config_load(const char *path);
+void libkanshi_config_destroy(struct libkanshi_config *config);
+
+struct libkanshi_mode {
+	int32_t width, height;
+	int32_t refresh; // mHz
+	bool preferred;
+};
+
+// Head state, as advertised by wlr-output-management
+struct libkanshi_head {
+	const char *name;
+	const char *description, *make, *model, *serial_number; // may be NULL
+	const struct libkanshi_mode *modes;
+	size_t modes_len;
+
+	bool enabled;
+	int current_mode; // index into modes, or -1
+	int32_t x, y;
+	int32_t transform; // enum wl_output_transform
+	double scale;
+	bool adaptive_sync;
+
+	// Left out of matching and kept in its current state, e.g. while it is
+	// plugged and unplugged repeatedly
+	bool damped;
+};
+
+enum libkanshi_field {
+	LIBKANSHI_FIELD_MODE = 1 << 0,
+	LIBKANSHI_FIELD_POSITION = 1 << 1,
+	LIBKANSHI_FIELD_SCALE = 1 << 2,
+	LIBKANSHI_FIELD_TRANSFORM = 1 << 3,
+	LIBKANSHI_FIELD_ADAPTIVE_SYNC = 1 << 4,
+};
+
+// Configuration of a head. The protocol requires all heads to be configured:
+// heads which are left as they are have enabled set to their current state
+// and no fields.
+struct libkanshi_head_plan {
+	const char *output; // matched profile output, NULL if unlisted or damped
+	bool enabled;
+	unsigned int fields; // enum libkanshi_field, the others are left as is
+
+	int mode; // index into the head modes
+	int32_t x, y;
+	int32_t transform; // enum wl_output_transform
+	double scale;
+	bool adaptive_sync;
+};
+
+// Strings are owned by the config
+struct libkanshi_plan {
+	const char *profile; // NULL if no profile matches
+	struct libkanshi_head_plan *heads; // one per head, in the given order
+	size_t heads_len;
+	const char **commands; // to run once the configuration succeeded
+	size_t commands_len;
+};
+
+enum libkanshi_match_status {
+	LIBKANSHI_MATCH_ERROR = -1, // out of memory or too many heads
+	LIBKANSHI_MATCH_NONE, // no profile matches the heads
+	LIBKANSHI_MATCH_OK,
+	// The matched profile sets a mode which a head doesn't have, the plan
+	// only has the profile name
+	LIBKANSHI_MATCH_UNSUPPORTED_MODE,
+};
+
+// Matches the heads against the profiles in file order and plans the first
+// profile which matches. The plan must be finished whatever the result. A
+// config can be matched from several threads at once.
+enum libkanshi_match_status libkanshi_match(
+	const struct libkanshi_config *config,
+	const struct libkanshi_head *heads, size_t heads_len,
+	struct libkanshi_plan *plan);
+void libkanshi_plan_finish(struct libkanshi_plan *plan);
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef KANSHI_LOG_H
+#define KANSHI_LOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+enum kanshi_log_level {
+	KANSHI_LOG_SILENT,
+	KANSHI_LOG_ERROR,
+	KANSHI_LOG_INFO,
+	KANSHI_LOG_DEBUG,
+};
+
+// A site logs at most LOG_RATE_BURST messages per LOG_RATE_INTERVAL_MS, the
+// rest are counted and reported with the next message which gets through, or
+// on their own once the interval is over
+#define LOG_RATE_BURST 10
+#define LOG_RATE_INTERVAL_MS 1000
+
+struct kanshi_log_site {
+	uint64_t window_start_ms;
+	unsigned int count, suppressed;
+	// Sites with suppressed messages to report, linked through next
+	enum kanshi_log_level level;
+	const char *fmt;
+	bool listed;
+	struct kanshi_log_site *next;
+};
+
+extern enum kanshi_log_level kanshi_log_verbosity;
+
+// Messages are a short description followed by key=value fields, string
+// values are double-quoted:
+//
+//   kanshi_log(KANSHI_LOG_INFO, "applying profile profile=\"%s\"", name);
+//
+// Arguments of disabled messages are not evaluated.
+#define kanshi_log(level, ...) \
+	do { \
+		if ((level) <= kanshi_log_verbosity) { \
+			static struct kanshi_log_site kanshi_log_call_site; \
+			kanshi_log_emit(&kanshi_log_call_site, (level), __VA_ARGS__); \
+		} \
+	} while (0)
+
+void kanshi_log_emit(struct kanshi_log_site *site, enum kanshi_log_level level,
+	const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+
+// Makes stderr fully buffered
+void kanshi_log_init(enum kanshi_log_level verbosity);
+// Reports the suppressed messages of the sites whose interval is over and
+// writes out buffered messages, called before blocking and forking
+void kanshi_log_flush(void);
+// Milliseconds until the interval of a site with suppressed messages is over,
+// or -1
+int kanshi_log_timeout(void);
+// Reports all suppressed messages and writes out buffered messages
+void kanshi_log_finish(void);
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef KANSHI_MATCH_H
+#define KANSHI_MATCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <wayland-client.h>
+
+// Lists of more heads than this, damped ones included, never match
+#define HEADS_MAX 64
+
+struct kanshi_compiled_config;
+struct kanshi_config;
+struct kanshi_head;
+struct kanshi_mode;
+struct kanshi_profile;
+struct kanshi_profile_output;
+
+bool match_profile_output(struct kanshi_profile_output *output,
+	struct kanshi_head *head);
+// matches[i] is set to the kanshi_profile_output for the i-th head, or NULL if
+// the head is damped
+bool match_profile(struct wl_list *heads, struct kanshi_profile *profile,
+	struct kanshi_profile_output *matches[static HEADS_MAX]);
+// Returns the first profile in file order matching the heads
+struct kanshi_profile *match(struct kanshi_config *config,
+	struct wl_list *heads,
+	struct kanshi_profile_output *matches[static HEADS_MAX]);
+// Smallest number of profiles for which matching is spread over a pool
+#define MATCH_POOL_MIN_PROFILES 4096
+
+struct kanshi_match_pool;
+
+// Starts threads matching profiles alongside the calling thread
+struct kanshi_match_pool *match_pool_create(int threads);
+void match_pool_destroy(struct kanshi_match_pool *pool);
+// Same as match, spreading the profiles over the pool
+struct kanshi_profile *match_pool_match(struct kanshi_match_pool *pool,
+	struct kanshi_config *config, struct wl_list *heads,
+	struct kanshi_profile_output *matches[static HEADS_MAX]);
+
+struct kanshi_matcher_bucket {
+	uint32_t *profiles; // indexes in the compiled config, in file order
+	size_t len;
+	uint64_t *ready; // bitset, set if each output name is connected
+};
+
+// Incremental matcher: tracks which profiles can match the counted heads as
+// they come and go, so that matching only tries those
+struct kanshi_matcher {
+	const struct kanshi_compiled_config *compiled;
+	// Used for buckets of at least MATCH_POOL_MIN_PROFILES, may be NULL
+	struct kanshi_match_pool *pool;
+	size_t heads_len; // counted heads
+	uint32_t *present; // per interned ID, counted heads with that name
+	// Profiles referencing each ID are refs[ref_offsets[id]..ref_offsets[id+1]]
+	uint32_t *ref_offsets, *refs;
+	// Per profile, required outputs whose name isn't present
+	uint32_t *unsatisfied;
+	uint32_t *bucket_index; // per profile, index in its bucket
+	// Profiles without optional outputs nor unlisted policy, by number of
+	// outputs, larger ones never match
+	struct kanshi_matcher_bucket buckets[HEADS_MAX + 1];
+	// Profiles which can match more heads than they require
+	struct kanshi_matcher_bucket flexible;
+};
+
+struct kanshi_matcher *matcher_create(
+	const struct kanshi_compiled_config *compiled);
+void matcher_destroy(struct kanshi_matcher *matcher);
+// Undamped heads are counted once all their properties are known
+void matcher_add_head(struct kanshi_matcher *matcher,
+	struct kanshi_head *head);
+void matcher_remove_head(struct kanshi_matcher *matcher,
+	struct kanshi_head *head);
+// Same as match, considering only the counted heads
+struct kanshi_profile *matcher_match(struct kanshi_matcher *matcher,
+	struct wl_list *heads,
+	struct kanshi_profile_output *matches[static HEADS_MAX]);
+struct kanshi_mode *match_mode(struct kanshi_head *head,
+	int width, int height, int refresh);
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef KANSHI_PARSER_H
 #define KANSHI_PARSER_H
 
+#include <stdbool.h>
 #include <stdio.h>
 
 struct kanshi_config;
@@ -16,6 +17,7 @@ struct kanshi_parser {
 	FILE *f;
 	int next;
 	int line, col;
+	bool allow_include;
 
 	enum kanshi_token_type tok_type;
 	char tok_str[1024];
@@ -23,5 +25,9 @@ struct kanshi_parser {
 };
 
 struct kanshi_config *parse_config(const char *path);
+// Parse a config from an in-memory buffer, which doesn't need to be
+// NUL-terminated. include directives are rejected.
+struct kanshi_config *parse_config_buffer(const char *buf, size_t size);
+void destroy_config(struct kanshi_config *config);
 
 #endif
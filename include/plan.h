@@ -0,0 +1,27 @@
+#ifndef KANSHI_PLAN_H
+#define KANSHI_PLAN_H
+
+#include <stdbool.h>
+
+#include "kanshi.h"
+
+struct kanshi_profile;
+struct kanshi_profile_output;
+
+// How a profile configures a head
+struct kanshi_head_plan {
+	// Parts of the state which are set, enum kanshi_output_field, the others
+	// are left as they are. KANSHI_OUTPUT_ENABLED is never set: whether the
+	// head is enabled is always part of the plan.
+	unsigned int fields;
+	struct kanshi_head_state state;
+};
+
+// Plans the configuration of a head by a profile, output is the profile output
+// the head matched, or NULL if the head is damped or unlisted. Returns false
+// if the head has no mode matching the one of the output.
+bool plan_head(const struct kanshi_profile *profile,
+	const struct kanshi_profile_output *output, struct kanshi_head *head,
+	struct kanshi_head_plan *plan);
+
+#endif
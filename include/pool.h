@@ -0,0 +1,24 @@
+#ifndef KANSHI_POOL_H
+#define KANSHI_POOL_H
+
+#include <stddef.h>
+
+#include "stats.h"
+
+// Free list of objects of a given size: freed objects are kept for the next
+// allocation rather than given back to the allocator, up to max_free of them
+struct kanshi_pool {
+	size_t size, max_free;
+	void *free; // linked through the first bytes of each object
+	struct kanshi_pool_stats *stats;
+};
+
+void kanshi_pool_init(struct kanshi_pool *pool, size_t size, size_t max_free,
+	struct kanshi_pool_stats *stats);
+// Returns a zeroed object, or NULL
+void *kanshi_pool_alloc(struct kanshi_pool *pool);
+void kanshi_pool_free(struct kanshi_pool *pool, void *object);
+// Gives the kept objects back to the allocator
+void kanshi_pool_finish(struct kanshi_pool *pool);
+
+#endif
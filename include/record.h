@@ -0,0 +1,17 @@
+#ifndef KANSHI_RECORD_H
+#define KANSHI_RECORD_H
+
+#include "kanshi.h"
+
+// Traces are written in the script format of bench/mock-compositor, which
+// replays them
+int kanshi_init_record(struct kanshi_state *state, const char *path);
+void kanshi_free_record(struct kanshi_state *state);
+
+void kanshi_record_done(struct kanshi_state *state);
+void kanshi_record_head_finished(struct kanshi_state *state,
+	struct kanshi_head *head);
+void kanshi_record_apply(struct kanshi_state *state);
+void kanshi_record_reply(struct kanshi_state *state, const char *reply);
+
+#endif
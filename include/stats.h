@@ -0,0 +1,59 @@
+#ifndef KANSHI_STATS_H
+#define KANSHI_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Number of apply latencies kept to compute percentiles
+#define KANSHI_STATS_LATENCY_SAMPLES 256
+
+// Object pools, see pool.h
+enum kanshi_pool_type {
+	KANSHI_POOL_HEADS,
+	KANSHI_POOL_MODES,
+	KANSHI_POOL_PENDING_PROFILES,
+	KANSHI_POOL_COUNT,
+};
+
+struct kanshi_pool_stats {
+	// Objects handed out by the allocator, and reused from the free list
+	uint64_t mallocs, reuses;
+	uint64_t in_use, free;
+};
+
+struct kanshi_stats {
+	uint64_t done_events;
+	// Matches against the whole config, and done events where the current
+	// profile still matched
+	uint64_t matches, match_cache_hits;
+	uint64_t applies, applies_succeeded, applies_failed, applies_cancelled;
+	// Applies abandoned because the compositor didn't reply, or because
+	// they were cancelled too many times in a row
+	uint64_t apply_timeouts, apply_retries_exhausted;
+	// Configurations restoring the previous state after a failed apply
+	uint64_t restores, restore_failures;
+	// Time between a failed apply and the end of its restore, last and worst
+	uint64_t recovery_ns, recovery_max_ns;
+	uint64_t commands, command_failures;
+	uint64_t reloads, reload_failures;
+	uint64_t damped_heads;
+	uint64_t parse_ns; // duration of the last config parse
+	struct kanshi_pool_stats pools[KANSHI_POOL_COUNT];
+
+	// Ring buffer of the last apply latencies
+	uint64_t latency_ns[KANSHI_STATS_LATENCY_SAMPLES];
+	size_t latency_len, latency_index;
+	uint64_t latency_count, latency_sum_ns;
+
+	const char *path; // Prometheus textfile, may be NULL
+};
+
+uint64_t kanshi_stats_now(void);
+void kanshi_stats_add_latency(struct kanshi_stats *stats, uint64_t ns);
+// Nearest-rank percentile of the sampled apply latencies, 0 if none
+uint64_t kanshi_stats_latency_percentile(const struct kanshi_stats *stats,
+	unsigned int percentile);
+// Rewrites the Prometheus textfile, if any
+void kanshi_stats_flush(const struct kanshi_stats *stats);
+
+#endif
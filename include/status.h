@@ -0,0 +1,50 @@
+#ifndef KANSHI_STATUS_H
+#define KANSHI_STATUS_H
+
+#include <stdint.h>
+
+#include "kanshi.h"
+
+// The status file is a read-only snapshot of kanshi's state which clients can
+// mmap instead of querying the daemon. It lives next to the IPC socket, at
+// $XDG_RUNTIME_DIR/fr.emersion.kanshi.$WAYLAND_DISPLAY.status.
+//
+// Readers follow the seqlock protocol: load seq with acquire semantics and
+// retry while it's odd, copy the struct, issue an acquire fence, and retry if
+// seq changed. The file's modification time is updated after each change,
+// which can be watched with inotify (IN_ATTRIB).
+
+#define KANSHI_STATUS_MAGIC 0x6b6e7368 // "kshn"
+#define KANSHI_STATUS_VERSION 1
+#define KANSHI_STATUS_HEADS_MAX 16
+#define KANSHI_STATUS_NAME_MAX 64
+#define KANSHI_STATUS_STRING_MAX 128
+
+struct kanshi_status_head {
+	char name[KANSHI_STATUS_NAME_MAX];
+	// Criteria of the profile output assigned to this head, empty if none
+	char output[KANSHI_STATUS_STRING_MAX];
+	uint32_t enabled;
+	int32_t width, height, refresh; // refresh in mHz
+	int32_t x, y;
+	int32_t transform; // enum wl_output_transform
+	double scale;
+};
+
+struct kanshi_status {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t seq; // odd while the status is being updated
+	uint32_t heads_len;
+	uint64_t generation; // incremented on each change
+	// Empty if none
+	char current_profile[KANSHI_STATUS_STRING_MAX];
+	char pending_profile[KANSHI_STATUS_STRING_MAX];
+	struct kanshi_status_head heads[KANSHI_STATUS_HEADS_MAX];
+};
+
+int kanshi_init_status(struct kanshi_state *state);
+void kanshi_free_status(struct kanshi_state *state);
+void kanshi_update_status(struct kanshi_state *state);
+
+#endif
@@ -4,7 +4,8 @@
 
 #include "ipc.h"
 
-int get_ipc_address(char *address, size_t size) {
+static int get_runtime_path(char *path, size_t size, const char *prefix,
+		const char *suffix) {
 	const char *wayland_display = getenv("WAYLAND_DISPLAY");
 	const char *xdg_runtime_dir = getenv("XDG_RUNTIME_DIR");
 	if (!wayland_display || !wayland_display[0]) {
@@ -16,6 +17,14 @@ int get_ipc_address(char *address, size_t size) {
 		return -1;
 	}
 
-	return snprintf(address, size, "unix:%s/fr.emersion.kanshi.%s",
-			xdg_runtime_dir, wayland_display);
+	return snprintf(path, size, "%s%s/fr.emersion.kanshi.%s%s",
+			prefix, xdg_runtime_dir, wayland_display, suffix);
+}
+
+int get_ipc_address(char *address, size_t size) {
+	return get_runtime_path(address, size, "unix:", "");
+}
+
+int get_status_path(char *path, size_t size) {
+	return get_runtime_path(path, size, "", ".status");
 }
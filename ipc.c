@@ -2,12 +2,14 @@
 #include <fcntl.h>
 #include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <varlink.h>
 
 #include "config.h"
 #include "kanshi.h"
 #include "ipc.h"
+#include "log.h"
 
 static long reply_error(VarlinkCall *call, const char *name) {
 	VarlinkObject *params = NULL;
@@ -66,6 +68,414 @@ static long handle_switch(VarlinkService *service, VarlinkCall *call,
 	return 0;
 }
 
+static VarlinkObject *mode_object(struct kanshi_mode *mode) {
+	VarlinkObject *object = NULL;
+	if (varlink_object_new(&object) < 0) {
+		return NULL;
+	}
+	varlink_object_set_int(object, "width", mode->width);
+	varlink_object_set_int(object, "height", mode->height);
+	varlink_object_set_int(object, "refresh", mode->refresh);
+	varlink_object_set_bool(object, "preferred", mode->preferred);
+	return object;
+}
+
+static VarlinkObject *head_object(struct kanshi_head *head) {
+	VarlinkObject *object = NULL;
+	VarlinkArray *modes = NULL;
+	if (varlink_object_new(&object) < 0 || varlink_array_new(&modes) < 0) {
+		goto error;
+	}
+
+	struct kanshi_mode *mode;
+	wl_list_for_each(mode, &head->modes, link) {
+		VarlinkObject *mode_obj = mode_object(mode);
+		if (mode_obj == NULL) {
+			goto error;
+		}
+		varlink_array_append_object(modes, mode_obj);
+		varlink_object_unref(mode_obj);
+	}
+
+	// Missing fields are null
+	varlink_object_set_string(object, "name", head->name);
+	if (head->description != NULL) {
+		varlink_object_set_string(object, "description", head->description);
+	}
+	if (head->make != NULL) {
+		varlink_object_set_string(object, "make", head->make);
+	}
+	if (head->model != NULL) {
+		varlink_object_set_string(object, "model", head->model);
+	}
+	if (head->serial_number != NULL) {
+		varlink_object_set_string(object, "serial", head->serial_number);
+	}
+	varlink_object_set_int(object, "physical_width", head->phys_width);
+	varlink_object_set_int(object, "physical_height", head->phys_height);
+	varlink_object_set_array(object, "modes", modes);
+	varlink_object_set_bool(object, "enabled", head->enabled);
+	if (head->mode != NULL) {
+		VarlinkObject *mode_obj = mode_object(head->mode);
+		if (mode_obj == NULL) {
+			goto error;
+		}
+		varlink_object_set_object(object, "current_mode", mode_obj);
+		varlink_object_unref(mode_obj);
+	}
+	varlink_object_set_int(object, "x", head->x);
+	varlink_object_set_int(object, "y", head->y);
+	varlink_object_set_int(object, "transform", head->transform);
+	varlink_object_set_float(object, "scale", head->scale);
+	varlink_object_set_bool(object, "adaptive_sync", head->adaptive_sync);
+	varlink_object_set_bool(object, "damped", head->damped);
+
+	varlink_array_unref(modes);
+	return object;
+
+error:
+	if (modes != NULL) {
+		varlink_array_unref(modes);
+	}
+	if (object != NULL) {
+		varlink_object_unref(object);
+	}
+	return NULL;
+}
+
+static long handle_get_state(VarlinkService *service, VarlinkCall *call,
+		VarlinkObject *parameters, uint64_t flags, void *userdata) {
+	struct kanshi_state *state = userdata;
+
+	VarlinkObject *out = NULL;
+	VarlinkArray *heads = NULL;
+	long ret = varlink_object_new(&out);
+	if (ret < 0) {
+		goto out;
+	}
+	ret = varlink_array_new(&heads);
+	if (ret < 0) {
+		goto out;
+	}
+
+	// Heads are inserted at the front of the list, report them in arrival
+	// order
+	struct kanshi_head *head;
+	wl_list_for_each_reverse(head, &state->heads, link) {
+		if (!head->announced || head->name == NULL) {
+			// Its properties are still being sent
+			continue;
+		}
+		VarlinkObject *head_obj = head_object(head);
+		if (head_obj == NULL) {
+			ret = -VARLINK_ERROR_PANIC;
+			goto out;
+		}
+		varlink_array_append_object(heads, head_obj);
+		varlink_object_unref(head_obj);
+	}
+
+	varlink_object_set_array(out, "heads", heads);
+	if (state->current_profile != NULL) {
+		varlink_object_set_string(out, "current_profile",
+			state->current_profile->name);
+	}
+	if (state->pending_profile != NULL) {
+		varlink_object_set_string(out, "pending_profile",
+			state->pending_profile->name);
+	}
+	ret = varlink_call_reply(call, out, 0);
+
+out:
+	if (heads != NULL) {
+		varlink_array_unref(heads);
+	}
+	if (out != NULL) {
+		varlink_object_unref(out);
+	}
+	return ret;
+}
+
+static long handle_list_profiles(VarlinkService *service, VarlinkCall *call,
+		VarlinkObject *parameters, uint64_t flags, void *userdata) {
+	struct kanshi_state *state = userdata;
+
+	VarlinkObject *out = NULL;
+	VarlinkArray *profiles = NULL;
+	long ret = varlink_object_new(&out);
+	if (ret < 0) {
+		goto out;
+	}
+	ret = varlink_array_new(&profiles);
+	if (ret < 0) {
+		goto out;
+	}
+
+	struct kanshi_profile *profile;
+	wl_list_for_each(profile, &state->config->profiles, link) {
+		varlink_array_append_string(profiles, profile->name);
+	}
+
+	varlink_object_set_array(out, "profiles", profiles);
+	ret = varlink_call_reply(call, out, 0);
+
+out:
+	if (profiles != NULL) {
+		varlink_array_unref(profiles);
+	}
+	if (out != NULL) {
+		varlink_object_unref(out);
+	}
+	return ret;
+}
+
+struct kanshi_ipc_monitor {
+	struct wl_list link;
+	VarlinkCall *call;
+	bool more;
+};
+
+static void destroy_monitor(struct kanshi_ipc_monitor *monitor) {
+	varlink_call_set_canceled_callback(monitor->call, NULL, NULL);
+	varlink_call_unref(monitor->call);
+	wl_list_remove(&monitor->link);
+	free(monitor);
+}
+
+static void monitor_handle_canceled(VarlinkCall *call, void *userdata) {
+	destroy_monitor(userdata);
+}
+
+static long handle_monitor(VarlinkService *service, VarlinkCall *call,
+		VarlinkObject *parameters, uint64_t flags, void *userdata) {
+	struct kanshi_state *state = userdata;
+
+	// Without the "more" flag, the call is answered with the next event
+	struct kanshi_ipc_monitor *monitor = calloc(1, sizeof(*monitor));
+	if (monitor == NULL) {
+		return -VARLINK_ERROR_PANIC;
+	}
+	monitor->call = varlink_call_ref(call);
+	monitor->more = flags & VARLINK_CALL_MORE;
+	varlink_call_set_canceled_callback(call, monitor_handle_canceled, monitor);
+	wl_list_insert(state->monitors.prev, &monitor->link);
+	return 0;
+}
+
+static const char *event_str(enum kanshi_ipc_event event) {
+	switch (event) {
+	case KANSHI_IPC_PROFILE_APPLIED:
+		return "profile_applied";
+	case KANSHI_IPC_PROFILE_FAILED:
+		return "profile_failed";
+	case KANSHI_IPC_HEAD_ADDED:
+		return "head_added";
+	case KANSHI_IPC_HEAD_REMOVED:
+		return "head_removed";
+	case KANSHI_IPC_HEAD_DAMPED:
+		return "head_damped";
+	case KANSHI_IPC_HEAD_UNDAMPED:
+		return "head_undamped";
+	case KANSHI_IPC_CONFIG_RELOADED:
+		return "config_reloaded";
+	}
+	return NULL;
+}
+
+struct kanshi_ipc_waiter {
+	struct wl_list link;
+	VarlinkCall *call;
+	char *profile; // NULL to wait for any profile
+};
+
+static void destroy_waiter(struct kanshi_ipc_waiter *waiter) {
+	varlink_call_set_canceled_callback(waiter->call, NULL, NULL);
+	varlink_call_unref(waiter->call);
+	wl_list_remove(&waiter->link);
+	free(waiter->profile);
+	free(waiter);
+}
+
+static void waiter_handle_canceled(VarlinkCall *call, void *userdata) {
+	destroy_waiter(userdata);
+}
+
+static long reply_profile(VarlinkCall *call, const char *profile) {
+	VarlinkObject *out = NULL;
+	long ret = varlink_object_new(&out);
+	if (ret < 0) {
+		return ret;
+	}
+	varlink_object_set_string(out, "profile", profile);
+	ret = varlink_call_reply(call, out, 0);
+	varlink_object_unref(out);
+	return ret;
+}
+
+static long handle_wait(VarlinkService *service, VarlinkCall *call,
+		VarlinkObject *parameters, uint64_t flags, void *userdata) {
+	struct kanshi_state *state = userdata;
+
+	const char *profile_name = NULL;
+	varlink_object_get_string(parameters, "profile", &profile_name);
+	if (profile_name != NULL) {
+		struct kanshi_profile *profile;
+		bool found = false;
+		wl_list_for_each(profile, &state->config->profiles, link) {
+			if (strcmp(profile->name, profile_name) == 0) {
+				found = true;
+				break;
+			}
+		}
+		if (!found) {
+			return reply_error(call, "fr.emersion.kanshi.ProfileNotFound");
+		}
+	}
+
+	struct kanshi_profile *current = state->current_profile;
+	if (current != NULL && state->pending_profile == NULL &&
+			(profile_name == NULL || strcmp(current->name, profile_name) == 0)) {
+		return reply_profile(call, current->name);
+	}
+
+	struct kanshi_ipc_waiter *waiter = calloc(1, sizeof(*waiter));
+	if (waiter == NULL) {
+		return -VARLINK_ERROR_PANIC;
+	}
+	if (profile_name != NULL) {
+		waiter->profile = strdup(profile_name);
+		if (waiter->profile == NULL) {
+			free(waiter);
+			return -VARLINK_ERROR_PANIC;
+		}
+	}
+	waiter->call = varlink_call_ref(call);
+	varlink_call_set_canceled_callback(call, waiter_handle_canceled, waiter);
+	wl_list_insert(state->waiters.prev, &waiter->link);
+	return 0;
+}
+
+static void resolve_waiters(struct kanshi_state *state,
+		enum kanshi_ipc_event event, const char *profile) {
+	if (event != KANSHI_IPC_PROFILE_APPLIED &&
+			event != KANSHI_IPC_PROFILE_FAILED) {
+		return;
+	}
+
+	struct kanshi_ipc_waiter *waiter, *tmp;
+	wl_list_for_each_safe(waiter, tmp, &state->waiters, link) {
+		if (waiter->profile != NULL && strcmp(waiter->profile, profile) != 0) {
+			continue;
+		}
+		if (event == KANSHI_IPC_PROFILE_APPLIED) {
+			reply_profile(waiter->call, profile);
+		} else {
+			reply_error(waiter->call, "fr.emersion.kanshi.ProfileNotApplied");
+		}
+		destroy_waiter(waiter);
+	}
+}
+
+void kanshi_ipc_send_event(struct kanshi_state *state,
+		enum kanshi_ipc_event event, const char *name) {
+	if (state->service == NULL) {
+		return;
+	}
+	resolve_waiters(state, event, name);
+	if (wl_list_empty(&state->monitors)) {
+		return;
+	}
+
+	VarlinkObject *out = NULL;
+	if (varlink_object_new(&out) < 0) {
+		return;
+	}
+	varlink_object_set_string(out, "event", event_str(event));
+	switch (event) {
+	case KANSHI_IPC_PROFILE_APPLIED:
+	case KANSHI_IPC_PROFILE_FAILED:
+		varlink_object_set_string(out, "profile", name);
+		break;
+	case KANSHI_IPC_HEAD_ADDED:
+	case KANSHI_IPC_HEAD_REMOVED:
+	case KANSHI_IPC_HEAD_DAMPED:
+	case KANSHI_IPC_HEAD_UNDAMPED:
+		varlink_object_set_string(out, "head", name);
+		break;
+	case KANSHI_IPC_CONFIG_RELOADED:
+		break;
+	}
+
+	struct kanshi_ipc_monitor *monitor, *tmp;
+	wl_list_for_each_safe(monitor, tmp, &state->monitors, link) {
+		uint64_t flags = monitor->more ? VARLINK_REPLY_CONTINUES : 0;
+		long ret = varlink_call_reply(monitor->call, out, flags);
+		if (ret < 0) {
+			kanshi_log(KANSHI_LOG_ERROR, "failed to send event to monitor "
+				"error=\"%s\"", varlink_error_string(-ret));
+		}
+		if (ret < 0 || !monitor->more) {
+			destroy_monitor(monitor);
+		}
+	}
+
+	varlink_object_unref(out);
+}
+
+static long handle_get_stats(VarlinkService *service, VarlinkCall *call,
+		VarlinkObject *parameters, uint64_t flags, void *userdata) {
+	struct kanshi_state *state = userdata;
+	const struct kanshi_stats *stats = &state->stats;
+
+	VarlinkObject *out = NULL;
+	long ret = varlink_object_new(&out);
+	if (ret < 0) {
+		return ret;
+	}
+
+	varlink_object_set_int(out, "done_events", stats->done_events);
+	varlink_object_set_int(out, "matches", stats->matches);
+	varlink_object_set_int(out, "match_cache_hits", stats->match_cache_hits);
+	varlink_object_set_int(out, "applies", stats->applies);
+	varlink_object_set_int(out, "applies_succeeded", stats->applies_succeeded);
+	varlink_object_set_int(out, "applies_failed", stats->applies_failed);
+	varlink_object_set_int(out, "applies_cancelled", stats->applies_cancelled);
+	varlink_object_set_int(out, "apply_timeouts", stats->apply_timeouts);
+	varlink_object_set_int(out, "apply_retries_exhausted",
+		stats->apply_retries_exhausted);
+	varlink_object_set_int(out, "restores", stats->restores);
+	varlink_object_set_int(out, "restore_failures", stats->restore_failures);
+	varlink_object_set_int(out, "recovery_us", stats->recovery_ns / 1000);
+	varlink_object_set_int(out, "recovery_max_us",
+		stats->recovery_max_ns / 1000);
+	varlink_object_set_int(out, "commands", stats->commands);
+	varlink_object_set_int(out, "command_failures", stats->command_failures);
+	varlink_object_set_int(out, "reloads", stats->reloads);
+	varlink_object_set_int(out, "reload_failures", stats->reload_failures);
+	varlink_object_set_int(out, "damped_heads", stats->damped_heads);
+	varlink_object_set_int(out, "parse_time_us", stats->parse_ns / 1000);
+	varlink_object_set_int(out, "apply_latency_samples", stats->latency_len);
+	varlink_object_set_int(out, "apply_latency_p50_us",
+		kanshi_stats_latency_percentile(stats, 50) / 1000);
+	varlink_object_set_int(out, "apply_latency_p90_us",
+		kanshi_stats_latency_percentile(stats, 90) / 1000);
+	varlink_object_set_int(out, "apply_latency_p99_us",
+		kanshi_stats_latency_percentile(stats, 99) / 1000);
+	varlink_object_set_int(out, "apply_latency_max_us",
+		kanshi_stats_latency_percentile(stats, 100) / 1000);
+	uint64_t pool_mallocs = 0, pool_reuses = 0;
+	for (size_t i = 0; i < KANSHI_POOL_COUNT; i++) {
+		pool_mallocs += stats->pools[i].mallocs;
+		pool_reuses += stats->pools[i].reuses;
+	}
+	varlink_object_set_int(out, "pool_mallocs", pool_mallocs);
+	varlink_object_set_int(out, "pool_reuses", pool_reuses);
+
+	ret = varlink_call_reply(call, out, 0);
+	varlink_object_unref(out);
+	return ret;
+}
+
 static int set_cloexec(int fd) {
 	int flags = fcntl(fd, F_GETFD);
 	if (flags < 0) {
@@ -100,6 +510,71 @@ int kanshi_init_ipc(struct kanshi_state *state, int listen_fd) {
 	const char *interface = "interface fr.emersion.kanshi\n"
 		"method Reload() -> ()\n"
 		"method Switch(profile: string) -> ()\n"
+		"type Mode (\n"
+		"  width: int,\n"
+		"  height: int,\n"
+		"  refresh: int,\n"
+		"  preferred: bool\n"
+		")\n"
+		"type Head (\n"
+		"  name: string,\n"
+		"  description: ?string,\n"
+		"  make: ?string,\n"
+		"  model: ?string,\n"
+		"  serial: ?string,\n"
+		"  physical_width: int,\n"
+		"  physical_height: int,\n"
+		"  modes: []Mode,\n"
+		"  enabled: bool,\n"
+		"  current_mode: ?Mode,\n"
+		"  x: int,\n"
+		"  y: int,\n"
+		"  transform: int,\n"
+		"  scale: float,\n"
+		"  adaptive_sync: bool,\n"
+		"  damped: bool\n"
+		")\n"
+		"method GetState() -> (\n"
+		"  heads: []Head,\n"
+		"  current_profile: ?string,\n"
+		"  pending_profile: ?string\n"
+		")\n"
+		"method ListProfiles() -> (profiles: []string)\n"
+		"method Monitor() -> (\n"
+		"  event: (profile_applied, profile_failed, head_added, head_removed,\n"
+		"    head_damped, head_undamped, config_reloaded),\n"
+		"  profile: ?string,\n"
+		"  head: ?string\n"
+		")\n"
+		"method Wait(profile: ?string) -> (profile: string)\n"
+		"method GetStats() -> (\n"
+		"  done_events: int,\n"
+		"  matches: int,\n"
+		"  match_cache_hits: int,\n"
+		"  applies: int,\n"
+		"  applies_succeeded: int,\n"
+		"  applies_failed: int,\n"
+		"  applies_cancelled: int,\n"
+		"  apply_timeouts: int,\n"
+		"  apply_retries_exhausted: int,\n"
+		"  restores: int,\n"
+		"  restore_failures: int,\n"
+		"  recovery_us: int,\n"
+		"  recovery_max_us: int,\n"
+		"  commands: int,\n"
+		"  command_failures: int,\n"
+		"  reloads: int,\n"
+		"  reload_failures: int,\n"
+		"  damped_heads: int,\n"
+		"  parse_time_us: int,\n"
+		"  apply_latency_samples: int,\n"
+		"  apply_latency_p50_us: int,\n"
+		"  apply_latency_p90_us: int,\n"
+		"  apply_latency_p99_us: int,\n"
+		"  apply_latency_max_us: int,\n"
+		"  pool_mallocs: int,\n"
+		"  pool_reuses: int\n"
+		")\n"
 		"error ProfileNotFound()\n"
 		"error ProfileNotMatched()\n"
 		"error ProfileNotApplied()\n";
@@ -107,6 +582,11 @@ int kanshi_init_ipc(struct kanshi_state *state, int listen_fd) {
 	long result = varlink_service_add_interface(service, interface,
 			"Reload", handle_reload, state,
 			"Switch", handle_switch, state,
+			"GetState", handle_get_state, state,
+			"ListProfiles", handle_list_profiles, state,
+			"Monitor", handle_monitor, state,
+			"Wait", handle_wait, state,
+			"GetStats", handle_get_stats, state,
 			NULL);
 	if (result != 0) {
 		fprintf(stderr, "varlink_service_add_interface failed: %s\n",
@@ -116,12 +596,22 @@ int kanshi_init_ipc(struct kanshi_state *state, int listen_fd) {
 	}
 
 	state->service = service;
+	wl_list_init(&state->monitors);
+	wl_list_init(&state->waiters);
 
 	return 0;
 }
 
 void kanshi_free_ipc(struct kanshi_state *state) {
 	if (state->service) {
+		struct kanshi_ipc_monitor *monitor, *tmp;
+		wl_list_for_each_safe(monitor, tmp, &state->monitors, link) {
+			destroy_monitor(monitor);
+		}
+		struct kanshi_ipc_waiter *waiter, *waiter_tmp;
+		wl_list_for_each_safe(waiter, waiter_tmp, &state->waiters, link) {
+			destroy_waiter(waiter);
+		}
 		varlink_service_free(state->service);
 		state->service = NULL;
 	}
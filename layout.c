@@ -0,0 +1,306 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "config.h"
+#include "kanshi.h"
+#include "layout.h"
+#include "log.h"
+#include "match.h"
+
+#define LAYOUT_VERSION 3
+
+struct kanshi_layout {
+	uint64_t heads_hash, config_hash;
+	char *profile;
+	// Whether the matcher chose the profile, rather than a switch
+	bool matched;
+	// Index in the profile's output list of the output assigned to each head
+	size_t outputs_len;
+	int outputs[HEADS_MAX];
+};
+
+static uint64_t hash_string(uint64_t hash, const char *str) {
+	// FNV-1a, including the NUL terminator so that fields can't run into
+	// each other
+	const unsigned char *p = (const unsigned char *)(str != NULL ? str : "");
+	do {
+		hash ^= *p;
+		hash *= 0x100000001b3;
+	} while (*p++ != '\0');
+	return hash;
+}
+
+static const uint64_t hash_init = 0xcbf29ce484222325;
+
+static uint64_t hash_heads(struct wl_list *heads) {
+	uint64_t hash = hash_init;
+	struct kanshi_head *head;
+	wl_list_for_each(head, heads, link) {
+		hash = hash_string(hash, head->name);
+		// Patterns can match descriptions, which can change while the head
+		// stays connected
+		hash = hash_string(hash, head->description);
+		hash = hash_string(hash, head->make);
+		hash = hash_string(hash, head->model);
+		hash = hash_string(hash, head->serial_number);
+	}
+	return hash;
+}
+
+// Only profile names, output criteria and whether unreachable profiles are
+// dropped decide which profile matches
+static uint64_t hash_config(struct kanshi_state *state) {
+	uint64_t hash = hash_init;
+	hash = hash_string(hash, state->drop_unreachable ? "drop-unreachable" : "");
+	struct kanshi_config *config = state->config;
+	struct kanshi_profile *profile;
+	wl_list_for_each(profile, &config->profiles, link) {
+		hash = hash_string(hash, profile->name);
+		struct kanshi_profile_output *output;
+		wl_list_for_each(output, &profile->outputs, link) {
+			hash = hash_string(hash, output->name);
+			if (output->optional) {
+				hash = hash_string(hash, "optional");
+			}
+		}
+		if (profile->unlisted != KANSHI_UNLISTED_NONE) {
+			hash = hash_string(hash, "unlisted");
+		}
+		hash = hash_string(hash, "");
+	}
+	return hash;
+}
+
+static int get_layout_path(char *path, size_t size, bool create_dir) {
+	char dir[PATH_MAX];
+	const char *xdg_state_home = getenv("XDG_STATE_HOME");
+	const char *home = getenv("HOME");
+	if (xdg_state_home != NULL && xdg_state_home[0] != '\0') {
+		snprintf(dir, sizeof(dir), "%s/kanshi", xdg_state_home);
+	} else if (home != NULL) {
+		snprintf(dir, sizeof(dir), "%s/.local/state/kanshi", home);
+	} else {
+		return -1;
+	}
+
+	if (create_dir) {
+		// Create missing parents, e.g. ~/.local/state
+		for (char *p = strchr(dir + 1, '/'); ; p = strchr(p + 1, '/')) {
+			if (p != NULL) {
+				*p = '\0';
+			}
+			if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+				kanshi_log(KANSHI_LOG_ERROR, "failed to create directory "
+					"path=\"%s\" error=\"%s\"", dir, strerror(errno));
+				return -1;
+			}
+			if (p == NULL) {
+				break;
+			}
+			*p = '/';
+		}
+	}
+
+	if (snprintf(path, size, "%s/layout", dir) >= (int)size) {
+		return -1;
+	}
+	return 0;
+}
+
+int kanshi_load_layout(struct kanshi_state *state) {
+	char path[PATH_MAX];
+	if (get_layout_path(path, sizeof(path), false) != 0) {
+		return -1;
+	}
+	FILE *f = fopen(path, "r");
+	if (f == NULL) {
+		return -1;
+	}
+
+	struct kanshi_layout *layout = calloc(1, sizeof(*layout));
+	if (layout == NULL) {
+		goto error;
+	}
+
+	int version, matched;
+	char profile[1024];
+	if (fscanf(f, "kanshi-layout %d\n", &version) != 1 ||
+			version != LAYOUT_VERSION ||
+			fscanf(f, "heads %" SCNx64 "\n", &layout->heads_hash) != 1 ||
+			fscanf(f, "config %" SCNx64 "\n", &layout->config_hash) != 1 ||
+			fscanf(f, "profile %1023[^\n]\n", profile) != 1 ||
+			fscanf(f, "matched %d\n", &matched) != 1) {
+		goto error;
+	}
+	layout->matched = matched != 0;
+	int n = -1;
+	if (fscanf(f, "outputs%n", &n) != 0 || n < 0) {
+		goto error;
+	}
+	int index;
+	while (fscanf(f, " %d", &index) == 1) {
+		if (layout->outputs_len >= HEADS_MAX || index < 0) {
+			goto error;
+		}
+		layout->outputs[layout->outputs_len++] = index;
+	}
+	layout->profile = strdup(profile);
+	if (layout->profile == NULL) {
+		goto error;
+	}
+
+	fclose(f);
+	state->layout = layout;
+	return 0;
+
+error:
+	kanshi_log(KANSHI_LOG_INFO, "ignoring invalid layout file path=\"%s\"",
+		path);
+	if (layout != NULL) {
+		free(layout->profile);
+		free(layout);
+	}
+	fclose(f);
+	return -1;
+}
+
+void kanshi_free_layout(struct kanshi_state *state) {
+	if (state->layout == NULL) {
+		return;
+	}
+	free(state->layout->profile);
+	free(state->layout);
+	state->layout = NULL;
+}
+
+struct kanshi_profile *kanshi_use_layout(struct kanshi_state *state,
+		struct kanshi_profile_output *matches[static HEADS_MAX]) {
+	struct kanshi_layout *layout = state->layout;
+	if (layout == NULL) {
+		return NULL;
+	}
+	state->layout = NULL;
+
+	struct kanshi_profile *found = NULL;
+	if (layout->heads_hash != hash_heads(&state->heads) ||
+			layout->outputs_len != (size_t)wl_list_length(&state->heads) ||
+			layout->config_hash != hash_config(state) ||
+			!layout->matched) {
+		goto out;
+	}
+
+	struct kanshi_profile *profile;
+	wl_list_for_each(profile, &state->config->profiles, link) {
+		if (strcmp(profile->name, layout->profile) == 0) {
+			found = profile;
+			break;
+		}
+	}
+	if (found == NULL) {
+		goto out;
+	}
+
+	struct kanshi_profile_output *outputs[HEADS_MAX];
+	size_t outputs_len = 0;
+	struct kanshi_profile_output *output;
+	wl_list_for_each(output, &found->outputs, link) {
+		if (outputs_len >= HEADS_MAX) {
+			found = NULL;
+			goto out;
+		}
+		outputs[outputs_len++] = output;
+	}
+
+	// Check each assignment, in case the heads changed in a way that isn't
+	// part of the hash
+	size_t i = 0;
+	struct kanshi_head *head;
+	wl_list_for_each(head, &state->heads, link) {
+		int index = layout->outputs[i];
+		if ((size_t)index == outputs_len &&
+				found->unlisted != KANSHI_UNLISTED_NONE) {
+			// Unlisted head
+			matches[i] = NULL;
+			i++;
+			continue;
+		}
+		if ((size_t)index >= outputs_len ||
+				!match_profile_output(outputs[index], head)) {
+			found = NULL;
+			goto out;
+		}
+		matches[i] = outputs[index];
+		i++;
+	}
+
+out:
+	free(layout->profile);
+	free(layout);
+	return found;
+}
+
+void kanshi_save_layout(struct kanshi_state *state,
+		struct kanshi_profile *profile) {
+	struct kanshi_profile_output *matches[HEADS_MAX];
+	if (!match_profile(&state->heads, profile, matches)) {
+		return;
+	}
+	// Profiles switched to, or kept after a switch, aren't the ones the
+	// matcher would choose on startup
+	struct kanshi_profile_output *matcher_matches[HEADS_MAX];
+	bool matched = matcher_match(state->matcher, &state->heads,
+		matcher_matches) == profile;
+
+	char path[PATH_MAX], tmp_path[PATH_MAX + 4];
+	if (get_layout_path(path, sizeof(path), true) != 0) {
+		return;
+	}
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+	FILE *f = fopen(tmp_path, "w");
+	if (f == NULL) {
+		kanshi_log(KANSHI_LOG_ERROR, "failed to open layout file "
+			"path=\"%s\" error=\"%s\"", tmp_path, strerror(errno));
+		return;
+	}
+
+	fprintf(f, "kanshi-layout %d\n", LAYOUT_VERSION);
+	fprintf(f, "heads %016" PRIx64 "\n", hash_heads(&state->heads));
+	fprintf(f, "config %016" PRIx64 "\n", hash_config(state));
+	fprintf(f, "profile %s\n", profile->name);
+	fprintf(f, "matched %d\n", matched);
+	fprintf(f, "outputs");
+	size_t i = 0;
+	struct kanshi_head *head;
+	wl_list_for_each(head, &state->heads, link) {
+		int index = 0;
+		struct kanshi_profile_output *output;
+		wl_list_for_each(output, &profile->outputs, link) {
+			if (output == matches[i]) {
+				break;
+			}
+			index++;
+		}
+		// Unlisted heads get the number of outputs
+		fprintf(f, " %d", index);
+		i++;
+	}
+	fprintf(f, "\n");
+
+	if (fclose(f) != 0) {
+		kanshi_log(KANSHI_LOG_ERROR, "failed to write layout file "
+			"path=\"%s\" error=\"%s\"", tmp_path, strerror(errno));
+		remove(tmp_path);
+		return;
+	}
+	if (rename(tmp_path, path) != 0) {
+		kanshi_log(KANSHI_LOG_ERROR, "failed to rename layout file "
+			"path=\"%s\" error=\"%s\"", tmp_path, strerror(errno));
+		remove(tmp_path);
+	}
+}
@@ -0,0 +1,218 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdbool.h>
+#include <stdlib.h>
+#include <wayland-client.h>
+
+#include "config.h"
+#include "kanshi.h"
+#include "libkanshi.h"
+#include "match.h"
+#include "parser.h"
+#include "plan.h"
+
+#if LIBKANSHI_HEADS_MAX != HEADS_MAX
+#error "LIBKANSHI_HEADS_MAX doesn't match HEADS_MAX"
+#endif
+
+// The library is built with hidden symbols, only the API is exported
+#define LIBKANSHI_EXPORT __attribute__((visibility("default")))
+
+struct libkanshi_config {
+	struct kanshi_config *config;
+};
+
+static struct libkanshi_config *wrap_config(struct kanshi_config *config) {
+	if (config == NULL) {
+		return NULL;
+	}
+	struct libkanshi_config *wrapper = calloc(1, sizeof(*wrapper));
+	if (wrapper == NULL) {
+		destroy_config(config);
+		return NULL;
+	}
+	wrapper->config = config;
+	return wrapper;
+}
+
+LIBKANSHI_EXPORT struct libkanshi_config *libkanshi_config_parse(
+		const char *text, size_t len) {
+	return wrap_config(parse_config_buffer(text, len));
+}
+
+LIBKANSHI_EXPORT struct libkanshi_config *libkanshi_config_load(
+		const char *path) {
+	return wrap_config(parse_config(path));
+}
+
+LIBKANSHI_EXPORT void libkanshi_config_destroy(
+		struct libkanshi_config *config) {
+	if (config == NULL) {
+		return;
+	}
+	destroy_config(config->config);
+	free(config);
+}
+
+// Engine heads pointing at the strings and modes of the caller
+struct engine_heads {
+	struct wl_list list; // kanshi_head.link, in the given order
+	struct kanshi_head *heads;
+	struct kanshi_mode *modes;
+};
+
+static bool init_engine_heads(struct engine_heads *engine,
+		const struct libkanshi_head *heads, size_t heads_len) {
+	size_t modes_len = 0;
+	for (size_t i = 0; i < heads_len; i++) {
+		modes_len += heads[i].modes_len;
+	}
+
+	wl_list_init(&engine->list);
+	engine->heads = calloc(heads_len, sizeof(*engine->heads));
+	engine->modes = calloc(modes_len, sizeof(*engine->modes));
+	if ((engine->heads == NULL && heads_len > 0) ||
+			(engine->modes == NULL && modes_len > 0)) {
+		free(engine->heads);
+		free(engine->modes);
+		return false;
+	}
+
+	struct kanshi_mode *mode = engine->modes;
+	for (size_t i = 0; i < heads_len; i++) {
+		const struct libkanshi_head *src = &heads[i];
+		struct kanshi_head *head = &engine->heads[i];
+		head->name = (char *)src->name;
+		head->description = (char *)src->description;
+		head->make = (char *)src->make;
+		head->model = (char *)src->model;
+		head->serial_number = (char *)src->serial_number;
+		head->enabled = src->enabled;
+		head->x = src->x;
+		head->y = src->y;
+		head->transform = src->transform;
+		head->scale = src->scale;
+		head->adaptive_sync = src->adaptive_sync;
+		head->damped = src->damped;
+
+		wl_list_init(&head->modes);
+		for (size_t j = 0; j < src->modes_len; j++, mode++) {
+			mode->head = head;
+			mode->width = src->modes[j].width;
+			mode->height = src->modes[j].height;
+			mode->refresh = src->modes[j].refresh;
+			mode->preferred = src->modes[j].preferred;
+			wl_list_insert(head->modes.prev, &mode->link);
+			if ((int)j == src->current_mode) {
+				head->mode = mode;
+			}
+		}
+		wl_list_insert(engine->list.prev, &head->link);
+	}
+	return true;
+}
+
+static void finish_engine_heads(struct engine_heads *engine) {
+	free(engine->heads);
+	free(engine->modes);
+}
+
+static unsigned int export_fields(unsigned int fields) {
+	unsigned int exported = 0;
+	if (fields & KANSHI_OUTPUT_MODE) {
+		exported |= LIBKANSHI_FIELD_MODE;
+	}
+	if (fields & KANSHI_OUTPUT_POSITION) {
+		exported |= LIBKANSHI_FIELD_POSITION;
+	}
+	if (fields & KANSHI_OUTPUT_SCALE) {
+		exported |= LIBKANSHI_FIELD_SCALE;
+	}
+	if (fields & KANSHI_OUTPUT_TRANSFORM) {
+		exported |= LIBKANSHI_FIELD_TRANSFORM;
+	}
+	if (fields & KANSHI_OUTPUT_ADAPTIVE_SYNC) {
+		exported |= LIBKANSHI_FIELD_ADAPTIVE_SYNC;
+	}
+	return exported;
+}
+
+static enum libkanshi_match_status plan_profile(struct kanshi_profile *profile,
+		struct kanshi_profile_output **matches, struct engine_heads *engine,
+		size_t heads_len, struct libkanshi_plan *plan) {
+	plan->heads = calloc(heads_len, sizeof(*plan->heads));
+	if (plan->heads == NULL && heads_len > 0) {
+		return LIBKANSHI_MATCH_ERROR;
+	}
+	plan->heads_len = heads_len;
+	for (size_t i = 0; i < heads_len; i++) {
+		struct kanshi_head *head = &engine->heads[i];
+		struct kanshi_head_plan head_plan;
+		if (!plan_head(profile, matches[i], head, &head_plan)) {
+			return LIBKANSHI_MATCH_UNSUPPORTED_MODE;
+		}
+		plan->heads[i] = (struct libkanshi_head_plan){
+			.output = matches[i] != NULL ? matches[i]->name : NULL,
+			.enabled = head_plan.state.enabled,
+			.fields = export_fields(head_plan.fields),
+			.x = head_plan.state.x,
+			.y = head_plan.state.y,
+			.transform = head_plan.state.transform,
+			.scale = head_plan.state.scale,
+			.adaptive_sync = head_plan.state.adaptive_sync,
+		};
+		if (head_plan.fields & KANSHI_OUTPUT_MODE) {
+			// The modes of a head are contiguous and in the given order
+			struct kanshi_mode *first =
+				wl_container_of(head->modes.next, first, link);
+			plan->heads[i].mode = head_plan.state.mode - first;
+		}
+	}
+
+	size_t commands_len = wl_list_length(&profile->commands);
+	plan->commands = calloc(commands_len, sizeof(*plan->commands));
+	if (plan->commands == NULL && commands_len > 0) {
+		return LIBKANSHI_MATCH_ERROR;
+	}
+	struct kanshi_profile_command *command;
+	wl_list_for_each(command, &profile->commands, link) {
+		plan->commands[plan->commands_len++] = command->command;
+	}
+	return LIBKANSHI_MATCH_OK;
+}
+
+LIBKANSHI_EXPORT enum libkanshi_match_status libkanshi_match(
+		const struct libkanshi_config *config,
+		const struct libkanshi_head *heads, size_t heads_len,
+		struct libkanshi_plan *plan) {
+	*plan = (struct libkanshi_plan){0};
+	if (heads_len > LIBKANSHI_HEADS_MAX) {
+		return LIBKANSHI_MATCH_ERROR;
+	}
+	struct engine_heads engine;
+	if (!init_engine_heads(&engine, heads, heads_len)) {
+		return LIBKANSHI_MATCH_ERROR;
+	}
+
+	struct kanshi_profile_output *matches[HEADS_MAX];
+	struct kanshi_profile *profile =
+		match(config->config, &engine.list, matches);
+	enum libkanshi_match_status status = LIBKANSHI_MATCH_NONE;
+	if (profile != NULL) {
+		status = plan_profile(profile, matches, &engine, heads_len, plan);
+		if (status != LIBKANSHI_MATCH_OK) {
+			libkanshi_plan_finish(plan);
+		}
+		if (status != LIBKANSHI_MATCH_ERROR) {
+			plan->profile = profile->name;
+		}
+	}
+
+	finish_engine_heads(&engine);
+	return status;
+}
+
+LIBKANSHI_EXPORT void libkanshi_plan_finish(struct libkanshi_plan *plan) {
+	free(plan->heads);
+	free(plan->commands);
+	*plan = (struct libkanshi_plan){0};
+}
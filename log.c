@@ -0,0 +1,147 @@
+#define _POSIX_C_SOURCE 200809L
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "log.h"
+
+enum kanshi_log_level kanshi_log_verbosity = KANSHI_LOG_INFO;
+
+static char buffer[16384];
+
+// Sites with suppressed messages which weren't reported yet
+static struct kanshi_log_site *suppressed_sites;
+
+static const char *const level_names[] = {
+	[KANSHI_LOG_ERROR] = "error",
+	[KANSHI_LOG_INFO] = "info",
+	[KANSHI_LOG_DEBUG] = "debug",
+};
+
+static uint64_t get_time_ms(const struct timespec *ts) {
+	return (uint64_t)ts->tv_sec * 1000 + ts->tv_nsec / 1000000;
+}
+
+static void print_prefix(const struct timespec *ts,
+		enum kanshi_log_level level) {
+	fprintf(stderr, "[%5lld.%06ld] %s: ", (long long)ts->tv_sec,
+		ts->tv_nsec / 1000, level_names[level]);
+}
+
+void kanshi_log_init(enum kanshi_log_level verbosity) {
+	kanshi_log_verbosity = verbosity;
+	setvbuf(stderr, buffer, _IOFBF, sizeof(buffer));
+}
+
+// Reports and forgets the suppressed messages of the sites whose interval is
+// over, or of all sites
+static void report_suppressed(bool all) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	uint64_t now_ms = get_time_ms(&ts);
+
+	struct kanshi_log_site **link = &suppressed_sites;
+	while (*link != NULL) {
+		struct kanshi_log_site *site = *link;
+		if (site->suppressed > 0 && !all &&
+				now_ms - site->window_start_ms < LOG_RATE_INTERVAL_MS) {
+			link = &site->next;
+			continue;
+		}
+		if (site->suppressed > 0) {
+			// Only the description of the messages, up to their first
+			// field or conversion
+			const char *end = strpbrk(site->fmt, "=%");
+			int len = end != NULL ? (int)(end - site->fmt) :
+				(int)strlen(site->fmt);
+			while (len > 0 && site->fmt[len - 1] != ' ' && end != NULL) {
+				len--;
+			}
+			while (len > 0 && site->fmt[len - 1] == ' ') {
+				len--;
+			}
+			if (len == 0) {
+				len = (int)strlen(site->fmt);
+			}
+			print_prefix(&ts, site->level);
+			fprintf(stderr, "%.*s suppressed=%u\n", len, site->fmt,
+				site->suppressed);
+			site->suppressed = 0;
+		}
+		*link = site->next;
+		site->listed = false;
+	}
+}
+
+void kanshi_log_flush(void) {
+	report_suppressed(false);
+	fflush(stderr);
+}
+
+int kanshi_log_timeout(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	uint64_t now_ms = get_time_ms(&ts);
+
+	int timeout = -1;
+	for (struct kanshi_log_site *site = suppressed_sites; site != NULL;
+			site = site->next) {
+		if (site->suppressed == 0) {
+			continue;
+		}
+		uint64_t end_ms = site->window_start_ms + LOG_RATE_INTERVAL_MS;
+		int left = end_ms <= now_ms ? 0 :
+			end_ms - now_ms > INT_MAX ? INT_MAX : (int)(end_ms - now_ms);
+		if (timeout < 0 || left < timeout) {
+			timeout = left;
+		}
+	}
+	return timeout;
+}
+
+void kanshi_log_finish(void) {
+	report_suppressed(true);
+	fflush(stderr);
+}
+
+void kanshi_log_emit(struct kanshi_log_site *site, enum kanshi_log_level level,
+		const char *fmt, ...) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	uint64_t now_ms = get_time_ms(&ts);
+
+	if (site->count == 0 ||
+			now_ms - site->window_start_ms >= LOG_RATE_INTERVAL_MS) {
+		site->window_start_ms = now_ms;
+		site->count = 0;
+	}
+	if (site->count >= LOG_RATE_BURST) {
+		site->suppressed++;
+		site->level = level;
+		site->fmt = fmt;
+		if (!site->listed) {
+			site->listed = true;
+			site->next = suppressed_sites;
+			suppressed_sites = site;
+		}
+		return;
+	}
+	site->count++;
+
+	print_prefix(&ts, level);
+	va_list args;
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+	if (site->suppressed > 0) {
+		fprintf(stderr, " suppressed=%u", site->suppressed);
+		site->suppressed = 0;
+	}
+	fputc('\n', stderr);
+
+	if (level == KANSHI_LOG_ERROR) {
+		fflush(stderr);
+	}
+}
@@ -1,5 +1,4 @@
 #define _POSIX_C_SOURCE 200809L
-#include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
@@ -12,85 +11,34 @@
 #include <unistd.h>
 #include <wayland-client.h>
 
+#include "check.h"
 #include "config.h"
+#include "damping.h"
 #include "kanshi.h"
+#include "match.h"
 #include "parser.h"
+#include "plan.h"
 #include "ipc.h"
+#include "layout.h"
+#include "log.h"
+#include "record.h"
+#include "status.h"
 #include "wlr-output-management-unstable-v1-client-protocol.h"
 
-#define HEADS_MAX 64
+// Time after which kanshi stops waiting for a reply to a configuration
+#define APPLY_TIMEOUT_MS 5000
+// Backoff between retries after a configuration is cancelled
+#define APPLY_RETRY_MIN_DELAY_MS 50
+#define APPLY_RETRY_MAX_DELAY_MS 2000
+#define APPLY_MAX_RETRIES 6
 
 static bool match_and_apply(struct kanshi_state *state,
 	kanshi_apply_done_func callback, void *data);
 
-static bool match_profile_output(struct kanshi_profile_output *output,
-		struct kanshi_head *head) {
-	const char *make = head->make ? head->make : "Unknown";
-	const char *model = head->model ? head->model : "Unknown";
-	const char *serial_number =
-		head->serial_number ? head->serial_number : "Unknown";
-
-	char identifier[1024];
-	assert(sizeof(identifier) >= strlen(make) + strlen(model) + strlen(serial_number) + 3);
-	snprintf(identifier, sizeof(identifier), "%s %s %s", make, model, serial_number);
-
-	return strcmp(output->name, "*") == 0 ||
-		strcmp(output->name, head->name) == 0 ||
-		strcmp(output->name, identifier) == 0;
-}
-
-static bool match_profile(struct kanshi_state *state,
-		struct kanshi_profile *profile,
-		struct kanshi_profile_output *matches[static HEADS_MAX]) {
-	if (wl_list_length(&profile->outputs) != wl_list_length(&state->heads)) {
-		return false;
-	}
-
-	memset(matches, 0, HEADS_MAX * sizeof(struct kanshi_head *));
-
-	// Wildcards are stored at the end of the list, so those will be matched
-	// last
-	struct kanshi_profile_output *profile_output;
-	wl_list_for_each(profile_output, &profile->outputs, link) {
-		bool output_matched = false;
-		ssize_t i = -1;
-		struct kanshi_head *head;
-		wl_list_for_each(head, &state->heads, link) {
-			i++;
-
-			if (matches[i] != NULL) {
-				continue; // already matched
-			}
-
-			if (match_profile_output(profile_output, head)) {
-				matches[i] = profile_output;
-				output_matched = true;
-				break;
-			}
-		}
-
-		if (!output_matched) {
-			return false;
-		}
-	}
-
-	return true;
-}
-
-static struct kanshi_profile *match(struct kanshi_state *state,
-		struct kanshi_profile_output *matches[static HEADS_MAX]) {
-	struct kanshi_profile *profile;
-	wl_list_for_each(profile, &state->config->profiles, link) {
-		if (match_profile(state, profile, matches)) {
-			return profile;
-		}
-	}
-	return NULL;
-}
-
-
-static void exec_command(char *cmd) {
+static bool exec_command(char *cmd) {
 	pid_t child, grandchild;
+	// Children would write out the parent's buffered messages again
+	kanshi_log_flush();
 	// Fork process
 	if ((child = fork()) == 0) {
 		// Fork child process again so we can unparent the process
@@ -110,87 +58,308 @@ static void exec_command(char *cmd) {
 
 		if ((grandchild = fork()) == 0) {
 			execl("/bin/sh", "/bin/sh", "-c", cmd, (void *)NULL);
-			fprintf(stderr, "Executing command '%s' failed: %s\n", cmd, strerror(errno));
+			kanshi_log(KANSHI_LOG_ERROR, "failed to execute command "
+				"command=\"%s\" error=\"%s\"", cmd, strerror(errno));
 			_exit(-1);
 		}
 		if (grandchild < 0) {
-			fprintf(stderr, "Impossible to fork a new process to execute"
-					" command '%s': %s\n", cmd, strerror(errno));
+			kanshi_log(KANSHI_LOG_ERROR, "failed to fork a new process "
+				"command=\"%s\" error=\"%s\"", cmd, strerror(errno));
 			_exit(1);
 		}
 		_exit(0); // Close child process
 	}
 
 	if (child < 0) {
-		perror("Impossible to fork a new process");
-		return;
+		kanshi_log(KANSHI_LOG_ERROR, "failed to fork a new process "
+			"error=\"%s\"", strerror(errno));
+		return false;
 	}
 
 	// cleanup child process
-	if (waitpid(child, NULL, 0) < 0) {
-		perror("Impossible to clean up child process");
+	int status;
+	if (waitpid(child, &status, 0) < 0) {
+		kanshi_log(KANSHI_LOG_ERROR, "failed to clean up child process "
+			"error=\"%s\"", strerror(errno));
+		return false;
 	}
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static void free_pending_profile(struct kanshi_pending_profile *pending) {
+	kanshi_pool_free(&pending->state->pools[KANSHI_POOL_PENDING_PROFILES],
+		pending);
 }
 
 static void config_handle_succeeded(void *data,
 		struct zwlr_output_configuration_v1 *config) {
 	struct kanshi_pending_profile *pending = data;
+	wl_list_remove(&pending->link);
+	kanshi_timer_disarm(&pending->watchdog);
 	zwlr_output_configuration_v1_destroy(config);
+	kanshi_record_reply(pending->state, "succeeded");
 
 	struct kanshi_state *state = pending->state;
 	struct kanshi_profile *profile = pending->profile;
+	state->stats.applies_succeeded++;
+	state->apply_retries = 0;
+	kanshi_stats_add_latency(&state->stats,
+		kanshi_stats_now() - pending->apply_ns);
 
 	struct kanshi_profile_command *command;
 	wl_list_for_each(command, &profile->commands, link) {
-		fprintf(stderr, "running command '%s'\n", command->command);
-		exec_command(command->command);
+		kanshi_log(KANSHI_LOG_INFO, "running command command=\"%s\"",
+			command->command);
+		state->stats.commands++;
+		if (!exec_command(command->command)) {
+			state->stats.command_failures++;
+		}
 	}
 
-	fprintf(stderr, "configuration for profile '%s' applied\n", profile->name);
+	kanshi_log(KANSHI_LOG_INFO, "configuration applied profile=\"%s\"",
+		profile->name);
 	state->current_profile = profile;
+	state->failed_profile = NULL;
+	struct kanshi_head *head;
+	wl_list_for_each(head, &state->heads, link) {
+		head->current_assignment = head->pending_assignment;
+	}
 	if (profile == state->pending_profile) {
 		state->pending_profile = NULL;
 	}
+	kanshi_update_status(state);
+	kanshi_save_layout(state, profile);
+#if KANSHI_HAS_VARLINK
+	kanshi_ipc_send_event(state, KANSHI_IPC_PROFILE_APPLIED, profile->name);
+#endif
 	if (pending->callback != NULL) {
 		pending->callback(pending->callback_data, true);
 	}
-	free(pending);
+	kanshi_stats_flush(&state->stats);
+	free_pending_profile(pending);
+}
+
+static void finish_restore(struct kanshi_state *state, const char *reply) {
+	struct kanshi_restore *restore = state->restore;
+	state->restore = NULL;
+	zwlr_output_configuration_v1_destroy(restore->config);
+	kanshi_record_reply(state, reply);
+
+	uint64_t ns = kanshi_stats_now() - restore->start_ns;
+	if (strcmp(reply, "succeeded") == 0) {
+		kanshi_log(KANSHI_LOG_INFO, "restored previous output configuration "
+			"duration_ms=%.3f", ns / 1e6);
+		state->stats.recovery_ns = ns;
+		if (ns > state->stats.recovery_max_ns) {
+			state->stats.recovery_max_ns = ns;
+		}
+	} else {
+		kanshi_log(KANSHI_LOG_ERROR, "failed to restore previous output "
+			"configuration reply=%s", reply);
+		state->stats.restore_failures++;
+	}
+	kanshi_stats_flush(&state->stats);
+	free(restore);
+}
+
+static void restore_handle_succeeded(void *data,
+		struct zwlr_output_configuration_v1 *config) {
+	finish_restore(data, "succeeded");
+}
+
+static void restore_handle_failed(void *data,
+		struct zwlr_output_configuration_v1 *config) {
+	finish_restore(data, "failed");
+}
+
+static void restore_handle_cancelled(void *data,
+		struct zwlr_output_configuration_v1 *config) {
+	finish_restore(data, "cancelled");
+}
+
+static const struct zwlr_output_configuration_v1_listener restore_listener = {
+	.succeeded = restore_handle_succeeded,
+	.failed = restore_handle_failed,
+	.cancelled = restore_handle_cancelled,
+};
+
+static void snapshot_heads(struct kanshi_state *state) {
+	struct kanshi_head *head;
+	wl_list_for_each(head, &state->heads, link) {
+		head->last_good = (struct kanshi_head_state){
+			.enabled = head->enabled,
+			.mode = head->mode,
+			.x = head->x,
+			.y = head->y,
+			.transform = head->transform,
+			.scale = head->scale,
+			.adaptive_sync = head->adaptive_sync,
+		};
+		head->has_last_good = true;
+	}
+}
+
+// Restores the head state saved before the last apply
+static void restore_heads(struct kanshi_state *state) {
+	if (state->restore != NULL || state->output_manager == NULL) {
+		return;
+	}
+	struct kanshi_restore *restore = calloc(1, sizeof(*restore));
+	if (restore == NULL) {
+		return;
+	}
+	restore->start_ns = kanshi_stats_now();
+
+	kanshi_log(KANSHI_LOG_INFO, "restoring previous output configuration");
+	restore->config = zwlr_output_manager_v1_create_configuration(
+		state->output_manager, state->serial);
+	zwlr_output_configuration_v1_add_listener(restore->config,
+		&restore_listener, state);
+
+	struct kanshi_head *head;
+	wl_list_for_each(head, &state->heads, link) {
+		// Heads which appeared since the last apply keep their state
+		struct kanshi_head_state *saved = &head->last_good;
+		bool enabled = head->has_last_good ? saved->enabled : head->enabled;
+		if (!enabled) {
+			zwlr_output_configuration_v1_disable_head(restore->config,
+				head->wlr_head);
+			continue;
+		}
+		struct zwlr_output_configuration_head_v1 *config_head =
+			zwlr_output_configuration_v1_enable_head(restore->config,
+				head->wlr_head);
+		if (!head->has_last_good) {
+			continue;
+		}
+		if (saved->mode != NULL) {
+			zwlr_output_configuration_head_v1_set_mode(config_head,
+				saved->mode->wlr_mode);
+		}
+		zwlr_output_configuration_head_v1_set_position(config_head,
+			saved->x, saved->y);
+		zwlr_output_configuration_head_v1_set_transform(config_head,
+			saved->transform);
+		zwlr_output_configuration_head_v1_set_scale(config_head,
+			wl_fixed_from_double(saved->scale));
+		if (zwlr_output_configuration_head_v1_get_version(config_head) >=
+				ZWLR_OUTPUT_CONFIGURATION_HEAD_V1_SET_ADAPTIVE_SYNC_SINCE_VERSION) {
+			zwlr_output_configuration_head_v1_set_adaptive_sync(config_head,
+				saved->adaptive_sync);
+		}
+	}
+
+	zwlr_output_configuration_v1_apply(restore->config);
+	kanshi_record_apply(state);
+	state->stats.restores++;
+	state->restore = restore;
 }
 
 static void config_handle_failed(void *data,
 		struct zwlr_output_configuration_v1 *config) {
 	struct kanshi_pending_profile *pending = data;
+	wl_list_remove(&pending->link);
+	kanshi_timer_disarm(&pending->watchdog);
 	zwlr_output_configuration_v1_destroy(config);
-	fprintf(stderr, "failed to apply configuration for profile '%s'\n",
-			pending->profile->name);
+	kanshi_record_reply(pending->state, "failed");
+	struct kanshi_stats *stats = &pending->state->stats;
+	stats->applies_failed++;
+	pending->state->apply_retries = 0;
+	kanshi_stats_add_latency(stats, kanshi_stats_now() - pending->apply_ns);
+	kanshi_log(KANSHI_LOG_ERROR, "failed to apply configuration "
+		"profile=\"%s\"", pending->profile->name);
+	// The compositor sends a done event after restoring, which must not
+	// apply the same profile again
+	pending->state->failed_profile = pending->profile;
+	pending->state->failed_heads_len = wl_list_length(&pending->state->heads);
 	if (pending->profile == pending->state->pending_profile) {
 		pending->state->pending_profile = NULL;
 	}
+	restore_heads(pending->state);
+	kanshi_update_status(pending->state);
+#if KANSHI_HAS_VARLINK
+	kanshi_ipc_send_event(pending->state, KANSHI_IPC_PROFILE_FAILED,
+		pending->profile->name);
+#endif
 	if (pending->callback != NULL) {
 		pending->callback(pending->callback_data, false);
 	}
-	free(pending);
+	kanshi_stats_flush(stats);
+	free_pending_profile(pending);
 }
 
 static void config_handle_cancelled(void *data,
 		struct zwlr_output_configuration_v1 *config) {
 	struct kanshi_pending_profile *pending = data;
+	wl_list_remove(&pending->link);
+	kanshi_timer_disarm(&pending->watchdog);
 	zwlr_output_configuration_v1_destroy(config);
-	// Wait for new serial
-	fprintf(stderr, "configuration for profile '%s' cancelled, retrying\n",
+	struct kanshi_state *state = pending->state;
+	kanshi_record_reply(state, "cancelled");
+	state->stats.applies_cancelled++;
+	if (pending->profile == state->pending_profile) {
+		state->pending_profile = NULL;
+	}
+
+	if (state->apply_retries >= APPLY_MAX_RETRIES) {
+		kanshi_log(KANSHI_LOG_ERROR, "configuration cancelled too many "
+			"times, giving up profile=\"%s\" retries=%d",
+			pending->profile->name, state->apply_retries);
+		state->apply_retries = 0;
+		state->stats.apply_retries_exhausted++;
+#if KANSHI_HAS_VARLINK
+		kanshi_ipc_send_event(state, KANSHI_IPC_PROFILE_FAILED,
 			pending->profile->name);
-	if (pending->profile == pending->state->pending_profile) {
-		pending->state->pending_profile = NULL;
+#endif
+	} else {
+		int delay_ms = APPLY_RETRY_MIN_DELAY_MS << state->apply_retries;
+		if (delay_ms > APPLY_RETRY_MAX_DELAY_MS) {
+			delay_ms = APPLY_RETRY_MAX_DELAY_MS;
+		}
+		state->apply_retries++;
+		kanshi_log(KANSHI_LOG_INFO, "configuration cancelled, retrying "
+			"profile=\"%s\" delay_ms=%d", pending->profile->name, delay_ms);
+		state->retry_serial = pending->serial;
+		kanshi_timer_arm(state, &state->retry_timer, delay_ms);
 	}
-	if (pending->serial != pending->state->serial) {
-		// We've already received a new serial, try re-applying the profile
-		// immediately
-		match_and_apply(pending->state, NULL, NULL);
+	kanshi_update_status(state);
+	if (pending->callback != NULL) {
+		pending->callback(pending->callback_data, false);
 	}
+	kanshi_stats_flush(&pending->state->stats);
+	free_pending_profile(pending);
+}
+
+static void handle_apply_timeout(struct kanshi_state *state, void *data) {
+	struct kanshi_pending_profile *pending = data;
+	kanshi_log(KANSHI_LOG_ERROR, "compositor didn't reply to the "
+		"configuration, giving up profile=\"%s\" timeout_ms=%d",
+		pending->profile->name, APPLY_TIMEOUT_MS);
+	// Replies to a destroyed configuration are ignored
+	wl_list_remove(&pending->link);
+	zwlr_output_configuration_v1_destroy(pending->config);
+	state->stats.apply_timeouts++;
+	state->apply_retries = 0;
+	if (pending->profile == state->pending_profile) {
+		state->pending_profile = NULL;
+	}
+	kanshi_update_status(state);
+#if KANSHI_HAS_VARLINK
+	kanshi_ipc_send_event(state, KANSHI_IPC_PROFILE_FAILED,
+		pending->profile->name);
+#endif
 	if (pending->callback != NULL) {
 		pending->callback(pending->callback_data, false);
 	}
-	free(pending);
+	kanshi_stats_flush(&state->stats);
+	free_pending_profile(pending);
+}
+
+static void handle_retry_timer(struct kanshi_state *state, void *data) {
+	// Otherwise, the next done event will match again
+	if (state->serial != state->retry_serial) {
+		kanshi_rematch(state);
+	}
 }
 
 static const struct zwlr_output_configuration_v1_listener config_listener = {
@@ -199,66 +368,75 @@ static const struct zwlr_output_configuration_v1_listener config_listener = {
 	.cancelled = config_handle_cancelled,
 };
 
-static bool match_refresh(const struct kanshi_mode *mode, int refresh, int *delta) {
-	int v = refresh - mode->refresh;
-	int mode_delta = abs(v);
-	/* If we have a refresh, pick one with the lowest delta from our target.
-	 * Doing a simple fuzzy match that picks the greatest (due to ordering) here can lead us to picking a refresh
-	 * such as 120.01 or 60.01, which is problematic for two reasons:
-	 *  - Modes such as 4K 120.01Hz is too much for link bandwidth of DP 1.4 without DSC.
-	 *  - It becomes out of phase with the majority of content being displayed.
-	 */
-	if (mode_delta < 50 && mode_delta < *delta) {
-		*delta = mode_delta;
-		return true;
-	}
-	return false;
-}
-
-static struct kanshi_mode *match_mode(struct kanshi_head *head,
-		int width, int height, int refresh) {
-	struct kanshi_mode *mode;
-	struct kanshi_mode *last_match = NULL;
-	int mode_delta = INT32_MAX;
-
-	wl_list_for_each(mode, &head->modes, link) {
-		if (mode->width != width || mode->height != height) {
+// Whether the heads which aren't damped were all configured with the outputs
+// in matches, by the current or the pending profile. Profiles with optional
+// outputs or unlisted heads keep matching when heads are plugged, but need to
+// be applied again.
+static bool is_assigned(struct kanshi_state *state,
+		struct kanshi_profile_output **matches, bool pending) {
+	ssize_t i = -1;
+	struct kanshi_head *head;
+	wl_list_for_each(head, &state->heads, link) {
+		i++;
+		const struct kanshi_head_assignment *assignment = pending ?
+			&head->pending_assignment : &head->current_assignment;
+		if (head->damped) {
 			continue;
 		}
-
-		if (refresh) {
-			if (match_refresh(mode, refresh, &mode_delta)) {
-				last_match = mode;
-			}
-		} else {
-			if (!last_match || mode->refresh > last_match->refresh) {
-				last_match = mode;
-			}
+		if (!assignment->configured || assignment->output != matches[i]) {
+			return false;
 		}
 	}
+	return true;
+}
 
-	return last_match;
+// Whether the compositor failed to apply the profile to the same heads
+// assigned to the same outputs
+static bool has_failed(struct kanshi_state *state,
+		struct kanshi_profile *profile, struct kanshi_profile_output **matches) {
+	return profile == state->failed_profile &&
+		wl_list_length(&state->heads) == state->failed_heads_len &&
+		is_assigned(state, matches, true);
+}
+
+static void reset_assignments(struct kanshi_state *state) {
+	struct kanshi_head *head;
+	wl_list_for_each(head, &state->heads, link) {
+		head->current_assignment = (struct kanshi_head_assignment){0};
+		head->pending_assignment = (struct kanshi_head_assignment){0};
+	}
 }
 
 static bool apply_profile(struct kanshi_state *state,
 		struct kanshi_profile *profile, struct kanshi_profile_output **matches,
 		kanshi_apply_done_func callback, void *data) {
-	if (state->pending_profile == profile || state->current_profile == profile) {
+	if ((state->pending_profile == profile &&
+			is_assigned(state, matches, true)) ||
+			(state->current_profile == profile &&
+			is_assigned(state, matches, false))) {
 		if (callback != NULL) {
 			callback(data, true);
 		}
 		return true;
 	}
+	if (state->output_manager == NULL) {
+		return false;
+	}
 
-	fprintf(stderr, "applying profile '%s'\n", profile->name);
+	kanshi_log(KANSHI_LOG_INFO, "applying profile profile=\"%s\"",
+		profile->name);
 
-	struct kanshi_pending_profile *pending = calloc(1, sizeof(*pending));
+	struct kanshi_pending_profile *pending =
+		kanshi_pool_alloc(&state->pools[KANSHI_POOL_PENDING_PROFILES]);
+	if (pending == NULL) {
+		return false;
+	}
+	kanshi_timer_init(&pending->watchdog, handle_apply_timeout, pending);
 	pending->serial = state->serial;
 	pending->state = state;
 	pending->profile = profile;
 	pending->callback = callback;
 	pending->callback_data = data;
-	state->pending_profile = profile;
 
 	struct zwlr_output_configuration_v1 *config =
 		zwlr_output_manager_v1_create_configuration(state->output_manager,
@@ -270,61 +448,79 @@ static bool apply_profile(struct kanshi_state *state,
 	wl_list_for_each(head, &state->heads, link) {
 		i++;
 		struct kanshi_profile_output *profile_output = matches[i];
+		if (profile_output != NULL) {
+			kanshi_log(KANSHI_LOG_DEBUG, "applying profile output "
+				"output=\"%s\" head=\"%s\"", profile_output->name,
+				head->name);
+		}
 
-		fprintf(stderr, "applying profile output '%s' on connected head '%s'\n",
-			profile_output->name, head->name);
-
-		bool enabled = head->enabled;
-		if (profile_output->fields & KANSHI_OUTPUT_ENABLED) {
-			enabled = profile_output->enabled;
+		struct kanshi_head_plan plan;
+		if (!plan_head(profile, profile_output, head, &plan)) {
+			kanshi_log(KANSHI_LOG_ERROR, "output doesn't support mode "
+				"head=\"%s\" mode=%dx%d@%fHz", head->name,
+				profile_output->mode.width, profile_output->mode.height,
+				(float)profile_output->mode.refresh / 1000);
+			goto error;
+		}
+		if (profile_output == NULL) {
+			kanshi_log(KANSHI_LOG_DEBUG, "configuring %s head head=\"%s\" "
+				"enabled=%d", head->damped ? "damped" : "unlisted",
+				head->name, plan.state.enabled);
 		}
 
-		if (!enabled) {
+		if (!plan.state.enabled) {
 			zwlr_output_configuration_v1_disable_head(config, head->wlr_head);
 			continue;
 		}
 
 		struct zwlr_output_configuration_head_v1 *config_head =
 			zwlr_output_configuration_v1_enable_head(config, head->wlr_head);
-		if (profile_output->fields & KANSHI_OUTPUT_MODE) {
-			// TODO: support custom modes
-			struct kanshi_mode *mode = match_mode(head,
-				profile_output->mode.width, profile_output->mode.height,
-				profile_output->mode.refresh);
-			if (mode == NULL) {
-				fprintf(stderr,
-					"output '%s' doesn't support mode '%dx%d@%fHz'\n",
-					head->name,
-					profile_output->mode.width, profile_output->mode.height,
-					(float)profile_output->mode.refresh / 1000);
-				goto error;
-			}
+		if (plan.fields & KANSHI_OUTPUT_MODE) {
 			zwlr_output_configuration_head_v1_set_mode(config_head,
-				mode->wlr_mode);
+				plan.state.mode->wlr_mode);
 		}
-		if (profile_output->fields & KANSHI_OUTPUT_POSITION) {
+		if (plan.fields & KANSHI_OUTPUT_POSITION) {
 			zwlr_output_configuration_head_v1_set_position(config_head,
-				profile_output->position.x, profile_output->position.y);
+				plan.state.x, plan.state.y);
 		}
-		if (profile_output->fields & KANSHI_OUTPUT_SCALE) {
+		if (plan.fields & KANSHI_OUTPUT_SCALE) {
 			zwlr_output_configuration_head_v1_set_scale(config_head,
-				wl_fixed_from_double(profile_output->scale));
+				wl_fixed_from_double(plan.state.scale));
 		}
-		if (profile_output->fields & KANSHI_OUTPUT_TRANSFORM) {
+		if (plan.fields & KANSHI_OUTPUT_TRANSFORM) {
 			zwlr_output_configuration_head_v1_set_transform(config_head,
-				profile_output->transform);
+				plan.state.transform);
 		}
-		if (profile_output->fields & KANSHI_OUTPUT_ADAPTIVE_SYNC) {
+		if (plan.fields & KANSHI_OUTPUT_ADAPTIVE_SYNC) {
 			zwlr_output_configuration_head_v1_set_adaptive_sync(config_head,
-				profile_output->adaptive_sync);
+				plan.state.adaptive_sync);
 		}
 	}
 
+	// The profile is only pending once its configuration is complete
+	i = -1;
+	wl_list_for_each(head, &state->heads, link) {
+		i++;
+		head->pending_assignment = (struct kanshi_head_assignment){
+			.configured = !head->damped,
+			.output = matches[i],
+		};
+	}
+	state->pending_profile = profile;
+	kanshi_update_status(state);
+	snapshot_heads(state);
+
 	zwlr_output_configuration_v1_apply(config);
+	pending->config = config;
+	wl_list_insert(&state->pending_configs, &pending->link);
+	kanshi_timer_arm(state, &pending->watchdog, APPLY_TIMEOUT_MS);
+	pending->apply_ns = kanshi_stats_now();
+	state->stats.applies++;
+	kanshi_record_apply(state);
 	return true;
 
 error:
-	free(pending);
+	free_pending_profile(pending);
 	zwlr_output_configuration_v1_destroy(config);
 	return false;
 }
@@ -349,16 +545,25 @@ static void mode_handle_preferred(void *data,
 	mode->preferred = true;
 }
 
-static void mode_handle_finished(void *data,
-		struct zwlr_output_mode_v1 *wlr_mode) {
-	struct kanshi_mode *mode = data;
+static void destroy_mode(struct kanshi_mode *mode) {
+	if (mode->head->mode == mode) {
+		mode->head->mode = NULL;
+	}
+	if (mode->head->last_good.mode == mode) {
+		mode->head->last_good.mode = NULL;
+	}
 	wl_list_remove(&mode->link);
 	if (zwlr_output_mode_v1_get_version(mode->wlr_mode) >= 3) {
 		zwlr_output_mode_v1_release(mode->wlr_mode);
 	} else {
 		zwlr_output_mode_v1_destroy(mode->wlr_mode);
 	}
-	free(mode);
+	kanshi_pool_free(&mode->head->state->pools[KANSHI_POOL_MODES], mode);
+}
+
+static void mode_handle_finished(void *data,
+		struct zwlr_output_mode_v1 *wlr_mode) {
+	destroy_mode(data);
 }
 
 static const struct zwlr_output_mode_v1_listener mode_listener = {
@@ -368,16 +573,31 @@ static const struct zwlr_output_mode_v1_listener mode_listener = {
 	.finished = mode_handle_finished,
 };
 
+// Heads own their strings, which the compositor may send again: replace them
+// in place rather than leaking the previous value
+static void set_head_string(char **dst, const char *value) {
+	if (*dst != NULL && strcmp(*dst, value) == 0) {
+		return;
+	}
+	size_t size = strlen(value) + 1;
+	char *str = realloc(*dst, size);
+	if (str == NULL) {
+		return;
+	}
+	memcpy(str, value, size);
+	*dst = str;
+}
+
 static void head_handle_name(void *data,
 		struct zwlr_output_head_v1 *wlr_head, const char *name) {
 	struct kanshi_head *head = data;
-	head->name = strdup(name);
+	set_head_string(&head->name, name);
 }
 
 static void head_handle_description(void *data,
 		struct zwlr_output_head_v1 *wlr_head, const char *description) {
 	struct kanshi_head *head = data;
-	head->description = strdup(description);
+	set_head_string(&head->description, description);
 }
 
 static void head_handle_physical_size(void *data,
@@ -392,7 +612,11 @@ static void head_handle_mode(void *data,
 		struct zwlr_output_mode_v1 *wlr_mode) {
 	struct kanshi_head *head = data;
 
-	struct kanshi_mode *mode = calloc(1, sizeof(*mode));
+	struct kanshi_mode *mode =
+		kanshi_pool_alloc(&head->state->pools[KANSHI_POOL_MODES]);
+	if (mode == NULL) {
+		return;
+	}
 	mode->head = head;
 	mode->wlr_mode = wlr_mode;
 	wl_list_insert(head->modes.prev, &mode->link);
@@ -420,7 +644,8 @@ static void head_handle_current_mode(void *data,
 			return;
 		}
 	}
-	fprintf(stderr, "received unknown current_mode\n");
+	kanshi_log(KANSHI_LOG_DEBUG, "received unknown current_mode "
+		"head=\"%s\"", head->name);
 	head->mode = NULL;
 }
 
@@ -443,42 +668,63 @@ static void head_handle_scale(void *data,
 	head->scale = wl_fixed_to_double(scale);
 }
 
-static void head_handle_finished(void *data,
-		struct zwlr_output_head_v1 *wlr_head) {
-	struct kanshi_head *head = data;
+static void destroy_head(struct kanshi_head *head) {
+	matcher_remove_head(head->state->matcher, head);
+#if KANSHI_HAS_VARLINK
+	if (head->announced) {
+		kanshi_ipc_send_event(head->state, KANSHI_IPC_HEAD_REMOVED,
+			head->name);
+	}
+#endif
+	// Modes are normally finished before their head
+	struct kanshi_mode *mode, *tmp;
+	wl_list_for_each_safe(mode, tmp, &head->modes, link) {
+		destroy_mode(mode);
+	}
 	wl_list_remove(&head->link);
 	if (zwlr_output_head_v1_get_version(head->wlr_head) >= 3) {
 		zwlr_output_head_v1_release(head->wlr_head);
 	} else {
 		zwlr_output_head_v1_destroy(head->wlr_head);
 	}
+	free(head->record);
 	free(head->name);
 	free(head->description);
 	free(head->make);
 	free(head->model);
 	free(head->serial_number);
-	free(head);
+	kanshi_pool_free(&head->state->pools[KANSHI_POOL_HEADS], head);
+}
+
+static void head_handle_finished(void *data,
+		struct zwlr_output_head_v1 *wlr_head) {
+	struct kanshi_head *head = data;
+	kanshi_record_head_finished(head->state, head);
+	if (head->announced) {
+		kanshi_damping_head_removed(head->state, head);
+	}
+	destroy_head(head);
 }
 
 void head_handle_make(void *data,
 		struct zwlr_output_head_v1 *zwlr_output_head_v1,
 		const char *make) {
 	struct kanshi_head *head = data;
-	head->make = strdup(make);
+	set_head_string(&head->make, make);
 }
 
 void head_handle_model(void *data,
 		struct zwlr_output_head_v1 *zwlr_output_head_v1,
 		const char *model) {
 	struct kanshi_head *head = data;
-	head->model = strdup(model);
+	set_head_string(&head->model, model);
 }
 
 void head_handle_serial_number(void *data,
 		struct zwlr_output_head_v1 *zwlr_output_head_v1,
 		const char *serial_number) {
 	struct kanshi_head *head = data;
-	head->serial_number = strdup(serial_number);
+	set_head_string(&head->serial_number, serial_number);
 }
 
 static void head_handle_adaptive_sync(void *data,
@@ -509,7 +755,11 @@ static void output_manager_handle_head(void *data,
 		struct zwlr_output_head_v1 *wlr_head) {
 	struct kanshi_state *state = data;
 
-	struct kanshi_head *head = calloc(1, sizeof(*head));
+	struct kanshi_head *head =
+		kanshi_pool_alloc(&state->pools[KANSHI_POOL_HEADS]);
+	if (head == NULL) {
+		return;
+	}
 	head->state = state;
 	head->wlr_head = wlr_head;
 	head->scale = 1.0;
@@ -521,40 +771,100 @@ static void output_manager_handle_head(void *data,
 
 static bool match_and_apply(struct kanshi_state *state,
 		kanshi_apply_done_func callback, void *data) {
-	assert(wl_list_length(&state->heads) <= HEADS_MAX);
+	int heads_len = wl_list_length(&state->heads);
+	if (heads_len > HEADS_MAX) {
+		kanshi_log(KANSHI_LOG_ERROR, "too many heads to match heads=%d "
+			"max=%d", heads_len, HEADS_MAX);
+		return false;
+	}
 	// matches[i] gives the kanshi_profile_output for the i-th head
 	struct kanshi_profile_output *matches[HEADS_MAX];
 	if (state->current_profile != NULL &&
-			match_profile(state, state->current_profile, matches)) {
-		// keep the current profile if it still matches
+			match_profile(&state->heads, state->current_profile, matches)) {
+		// keep the current profile if it still matches, and apply it again
+		// if heads were assigned to its outputs differently
+		if (has_failed(state, state->current_profile, matches)) {
+			goto failed;
+		} else if (!is_assigned(state, matches, false)) {
+			return apply_profile(state, state->current_profile, matches,
+				callback, data);
+		}
+		state->stats.match_cache_hits++;
 		if (callback != NULL) {
 			callback(data, true);
 		}
 		return true;
 	}
-	struct kanshi_profile *profile = match(state, matches);
-	if (profile != NULL) {
+	state->stats.matches++;
+	struct kanshi_profile *profile = matcher_match(state->matcher,
+		&state->heads, matches);
+	if (profile != NULL && has_failed(state, profile, matches)) {
+		goto failed;
+	} else if (profile != NULL) {
 		return apply_profile(state, profile, matches, callback, data);
 	}
-	fprintf(stderr, "no profile matched\n");
+	kanshi_log(KANSHI_LOG_INFO, "no profile matched");
+	return false;
+
+failed:
+	kanshi_log(KANSHI_LOG_DEBUG, "not applying profile which failed with "
+		"the same heads profile=\"%s\"", state->failed_profile->name);
 	return false;
 }
 
 bool kanshi_switch(struct kanshi_state *state, struct kanshi_profile *profile,
 		kanshi_apply_done_func callback, void *data) {
 	struct kanshi_profile_output *matches[HEADS_MAX];
-	if (!match_profile(state, profile, matches)) {
+	if (!match_profile(&state->heads, profile, matches)) {
 		return false;
 	}
 
 	return apply_profile(state, profile, matches, callback, data);
 }
 
+bool kanshi_rematch(struct kanshi_state *state) {
+	bool ok = match_and_apply(state, NULL, NULL);
+	kanshi_update_status(state);
+	return ok;
+}
+
 static void output_manager_handle_done(void *data,
 		struct zwlr_output_manager_v1 *manager, uint32_t serial) {
 	struct kanshi_state *state = data;
 	state->serial = serial;
-	match_and_apply(state, NULL, NULL);
+	state->stats.done_events++;
+	kanshi_record_done(state);
+
+	struct kanshi_head *head;
+	wl_list_for_each_reverse(head, &state->heads, link) {
+		if (head->announced) {
+			continue;
+		}
+		head->announced = true;
+		kanshi_damping_head_added(state, head);
+		if (!head->damped) {
+			matcher_add_head(state->matcher, head);
+		}
+#if KANSHI_HAS_VARLINK
+		kanshi_ipc_send_event(state, KANSHI_IPC_HEAD_ADDED, head->name);
+#endif
+	}
+
+	// On startup, skip matching if the last layout is still valid
+	struct kanshi_profile_output *matches[HEADS_MAX];
+	struct kanshi_profile *profile = kanshi_use_layout(state, matches);
+	if (kanshi_timer_armed(&state->retry_timer)) {
+		// Back off after a cancelled configuration, the retry timer will
+		// match again
+	} else if (profile != NULL) {
+		kanshi_log(KANSHI_LOG_INFO, "reusing last layout profile=\"%s\"",
+			profile->name);
+		apply_profile(state, profile, matches, NULL, NULL);
+	} else {
+		match_and_apply(state, NULL, NULL);
+	}
+	kanshi_update_status(state);
+	kanshi_stats_flush(&state->stats);
 }
 
 static void output_manager_handle_finished(void *data,
@@ -596,6 +906,93 @@ static const struct wl_registry_listener registry_listener = {
 	.global_remove = registry_handle_global_remove,
 };
 
+// Sends the registry request without waiting for the reply
+static bool connect_display(struct kanshi_state *state) {
+	state->display = wl_display_connect(NULL);
+	if (state->display == NULL) {
+		kanshi_log(KANSHI_LOG_ERROR, "failed to connect to display");
+		return false;
+	}
+	state->registry = wl_display_get_registry(state->display);
+	wl_registry_add_listener(state->registry, &registry_listener, state);
+	wl_display_flush(state->display);
+	return true;
+}
+
+static bool finish_connect(struct kanshi_state *state) {
+	if (wl_display_roundtrip(state->display) < 0) {
+		kanshi_log(KANSHI_LOG_ERROR, "wl_display_roundtrip() failed");
+		return false;
+	}
+	if (state->output_manager == NULL) {
+		kanshi_log(KANSHI_LOG_ERROR, "compositor doesn't support "
+			"wlr-output-management-unstable-v1");
+		return false;
+	}
+	return true;
+}
+
+bool kanshi_connect(struct kanshi_state *state) {
+	if (!connect_display(state)) {
+		return false;
+	}
+	if (!finish_connect(state)) {
+		kanshi_disconnect(state);
+		return false;
+	}
+	return true;
+}
+
+// Stops waiting for the replies to the configurations in flight, including a
+// restore, and for the retry after a cancelled one, the replies to destroyed
+// configurations are ignored
+static void abandon_pending_configs(struct kanshi_state *state) {
+	struct kanshi_pending_profile *pending, *pending_tmp;
+	wl_list_for_each_safe(pending, pending_tmp, &state->pending_configs, link) {
+		wl_list_remove(&pending->link);
+		kanshi_timer_disarm(&pending->watchdog);
+		zwlr_output_configuration_v1_destroy(pending->config);
+		if (pending->callback != NULL) {
+			pending->callback(pending->callback_data, false);
+		}
+		free_pending_profile(pending);
+	}
+	if (state->restore != NULL) {
+		zwlr_output_configuration_v1_destroy(state->restore->config);
+		free(state->restore);
+		state->restore = NULL;
+	}
+	kanshi_timer_disarm(&state->retry_timer);
+	state->apply_retries = 0;
+	state->pending_profile = NULL;
+}
+
+void kanshi_disconnect(struct kanshi_state *state) {
+	abandon_pending_configs(state);
+
+	struct kanshi_head *head, *head_tmp;
+	wl_list_for_each_safe(head, head_tmp, &state->heads, link) {
+		destroy_head(head);
+	}
+
+	if (state->output_manager != NULL) {
+		zwlr_output_manager_v1_destroy(state->output_manager);
+		state->output_manager = NULL;
+	}
+	if (state->registry != NULL) {
+		wl_registry_destroy(state->registry);
+		state->registry = NULL;
+	}
+	wl_display_disconnect(state->display);
+	state->display = NULL;
+
+	// The next compositor may have a different output configuration
+	state->serial = 0;
+	state->current_profile = NULL;
+	state->failed_profile = NULL;
+	kanshi_update_status(state);
+}
+
 static struct kanshi_config *read_config(const char *config) {
 	if (config != NULL) {
 		return parse_config(config);
@@ -612,71 +1009,223 @@ static struct kanshi_config *read_config(const char *config) {
 		snprintf(config_path, sizeof(config_path), "%s/.config/%s",
 			home, config_filename);
 	} else {
-		fprintf(stderr, "HOME not set\n");
+		kanshi_log(KANSHI_LOG_ERROR, "HOME not set");
 		return NULL;
 	}
 
 	return parse_config(config_path);
 }
 
-static void destroy_config(struct kanshi_config *config) {
-	struct kanshi_profile *profile, *tmp_profile;
-	wl_list_for_each_safe(profile, tmp_profile, &config->profiles, link) {
-		struct kanshi_profile_output *output, *tmp_output;
-		wl_list_for_each_safe(output, tmp_output, &profile->outputs, link) {
-			free(output->name);
-			wl_list_remove(&output->link);
-			free(output);
+// Logs the profiles which can never be matched, and drops them from the
+// compiled config if asked to
+static bool check_config(struct kanshi_config *config, bool drop) {
+	struct kanshi_compiled_config *compiled = config->compiled;
+	struct kanshi_check_result *results =
+		calloc(compiled->profiles_len + 1, sizeof(*results));
+	if (results == NULL) {
+		return false;
+	}
+	ssize_t unreachable = check_compiled_config(compiled, results);
+	if (unreachable < 0) {
+		free(results);
+		return false;
+	}
+	for (size_t p = 0; p < compiled->profiles_len; p++) {
+		if (results[p].reason == KANSHI_CHECK_REACHABLE) {
+			continue;
 		}
-		struct kanshi_profile_command *command, *tmp_command;
-		wl_list_for_each_safe(command, tmp_command, &profile->commands, link) {
-			free(command->command);
-			wl_list_remove(&command->link);
-			free(command);
+		const char *shadowed_by = "";
+		if (results[p].reason != KANSHI_CHECK_TOO_MANY_OUTPUTS) {
+			shadowed_by =
+				compiled->profiles[results[p].shadowed_by].profile->name;
+		}
+		kanshi_log(KANSHI_LOG_DEBUG, "profile can never be matched "
+			"profile=\"%s\" reason=%s shadowed_by=\"%s\"",
+			compiled->profiles[p].profile->name,
+			check_reason_str(results[p].reason), shadowed_by);
+	}
+	if (unreachable > 0) {
+		kanshi_log(KANSHI_LOG_INFO, "profiles can never be matched "
+			"count=%zd dropped=%s", unreachable, drop ? "true" : "false");
+	}
+	if (drop) {
+		drop_unreachable_profiles(compiled, results);
+	}
+	free(results);
+	return true;
+}
+
+// Replaces the config and counts the current heads for its profiles
+static bool set_config(struct kanshi_state *state,
+		struct kanshi_config *config) {
+	if (!check_config(config, state->drop_unreachable)) {
+		return false;
+	}
+	struct kanshi_matcher *matcher = matcher_create(config->compiled);
+	if (matcher == NULL) {
+		return false;
+	}
+	struct kanshi_head *head;
+	wl_list_for_each(head, &state->heads, link) {
+		head->counted = false;
+		if (head->announced && !head->damped) {
+			matcher_add_head(matcher, head);
 		}
-		wl_list_remove(&profile->link);
-		free(profile);
 	}
-	free(config);
+
+	matcher_destroy(state->matcher);
+	if (state->config != NULL) {
+		// The pending configurations, the current profile and the assigned
+		// outputs point into the old config
+		abandon_pending_configs(state);
+		state->current_profile = NULL;
+		state->failed_profile = NULL;
+		reset_assignments(state);
+		destroy_config(state->config);
+	}
+	matcher->pool = state->match_pool;
+	state->matcher = matcher;
+	state->config = config;
+	return true;
 }
 
 bool kanshi_reload_config(struct kanshi_state *state,
 		kanshi_apply_done_func callback, void *data) {
-	fprintf(stderr, "reloading config\n");
+	kanshi_log(KANSHI_LOG_INFO, "reloading config");
+	state->stats.reloads++;
+	uint64_t parse_start_ns = kanshi_stats_now();
 	struct kanshi_config *config = read_config(state->config_arg);
+	state->stats.parse_ns = kanshi_stats_now() - parse_start_ns;
 	if (config == NULL) {
+		state->stats.reload_failures++;
+		kanshi_stats_flush(&state->stats);
 		return false;
 	}
-	destroy_config(state->config);
-	state->config = config;
-	state->pending_profile = NULL;
-	state->current_profile = NULL;
-	return match_and_apply(state, callback, data);
+	if (!set_config(state, config)) {
+		destroy_config(config);
+		state->stats.reload_failures++;
+		kanshi_stats_flush(&state->stats);
+		return false;
+	}
+	kanshi_update_status(state);
+#if KANSHI_HAS_VARLINK
+	kanshi_ipc_send_event(state, KANSHI_IPC_CONFIG_RELOADED, NULL);
+#endif
+	bool ok = match_and_apply(state, callback, data);
+	kanshi_stats_flush(&state->stats);
+	return ok;
+}
+
+// Prints the profiles which can never be matched, for --check
+static int check_config_file(const char *config_arg) {
+	struct kanshi_config *config = read_config(config_arg);
+	if (config == NULL) {
+		return EXIT_FAILURE;
+	}
+	struct kanshi_compiled_config *compiled = config->compiled;
+	struct kanshi_check_result *results =
+		calloc(compiled->profiles_len + 1, sizeof(*results));
+	if (results == NULL) {
+		destroy_config(config);
+		return EXIT_FAILURE;
+	}
+	ssize_t unreachable = check_compiled_config(compiled, results);
+	for (size_t p = 0; unreachable > 0 && p < compiled->profiles_len; p++) {
+		const char *name = compiled->profiles[p].profile->name;
+		const struct kanshi_check_result *result = &results[p];
+		const char *other = "";
+		if (result->reason != KANSHI_CHECK_REACHABLE &&
+				result->reason != KANSHI_CHECK_TOO_MANY_OUTPUTS) {
+			other = compiled->profiles[result->shadowed_by].profile->name;
+		}
+		switch (result->reason) {
+		case KANSHI_CHECK_REACHABLE:
+			break;
+		case KANSHI_CHECK_DUPLICATE:
+			printf("profile '%s' has the same outputs as profile '%s'\n",
+				name, other);
+			break;
+		case KANSHI_CHECK_SHADOWED:
+			printf("profile '%s' is shadowed by profile '%s'\n", name, other);
+			break;
+		case KANSHI_CHECK_TOO_MANY_OUTPUTS:
+			printf("profile '%s' requires more than %d outputs\n",
+				name, HEADS_MAX);
+			break;
+		}
+	}
+	free(results);
+	destroy_config(config);
+	return unreachable == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 static const char usage[] = "Usage: %s [options...]\n"
 "  -h, --help           Show help message and quit\n"
-"  -c, --config <path>  Path to config file.\n";
+"  -c, --config <path>  Path to config file.\n"
+"  -r, --record <path>  Record a trace of output events to replay later.\n"
+"  -v, --verbose        Also log each output of applied profiles.\n"
+"  -q, --quiet          Only log errors.\n"
+"  --stats-file <path>  Write statistics in the Prometheus text format.\n"
+"  --match-threads <n>  Match very large configs with n extra threads.\n"
+"  --check              Report profiles which can never be matched and quit.\n"
+"  --drop-unreachable   Don't try to match these profiles.\n";
 
 static const struct option long_options[] = {
 	{"help", no_argument, 0, 'h'},
 	{"config", required_argument, 0, 'c'},
 	{"listen-fd", required_argument, 0, 'l'},
+	{"record", required_argument, 0, 'r'},
+	{"stats-file", required_argument, 0, 'S'},
+	{"match-threads", required_argument, 0, 'M'},
+	{"check", no_argument, 0, 'C'},
+	{"drop-unreachable", no_argument, 0, 'D'},
+	{"verbose", no_argument, 0, 'v'},
+	{"quiet", no_argument, 0, 'q'},
 	{0},
 };
 
 int main(int argc, char *argv[]) {
 	const char *config_arg = NULL;
+	const char *record_arg = NULL;
+	const char *stats_arg = NULL;
+	int match_threads = 0;
+	bool check = false, drop_unreachable = false;
+	enum kanshi_log_level verbosity = KANSHI_LOG_INFO;
 #if KANSHI_HAS_VARLINK
 	int listen_fd = -1;
 #endif
 
 	int opt;
-	while ((opt = getopt_long(argc, argv, "hc:l:", long_options, NULL)) != -1) {
+	while ((opt = getopt_long(argc, argv, "hc:l:r:vq", long_options, NULL)) != -1) {
 		switch (opt) {
 		case 'c':
 			config_arg = optarg;
 			break;
+		case 'r':
+			record_arg = optarg;
+			break;
+		case 'S':
+			stats_arg = optarg;
+			break;
+		case 'M':
+			match_threads = strtol(optarg, NULL, 10);
+			if (match_threads < 0) {
+				fprintf(stderr, "invalid number of match threads\n");
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'C':
+			check = true;
+			break;
+		case 'D':
+			drop_unreachable = true;
+			break;
+		case 'v':
+			verbosity = KANSHI_LOG_DEBUG;
+			break;
+		case 'q':
+			verbosity = KANSHI_LOG_ERROR;
+			break;
 		case 'l':
 #if KANSHI_HAS_VARLINK
 			listen_fd = strtol(optarg, NULL, 10);
@@ -695,42 +1244,72 @@ int main(int argc, char *argv[]) {
 		}
 	}
 
-	struct kanshi_config *config = read_config(config_arg);
-	if (config == NULL) {
-		return EXIT_FAILURE;
-	}
+	kanshi_log_init(verbosity);
 
-	struct wl_display *display = wl_display_connect(NULL);
-	if (display == NULL) {
-		fprintf(stderr, "failed to connect to display\n");
-		return EXIT_FAILURE;
+	if (check) {
+		return check_config_file(config_arg);
 	}
 
 	struct kanshi_state state = {
 		.running = true,
-		.display = display,
-		.config = config,
 		.config_arg = config_arg,
+		.drop_unreachable = drop_unreachable,
+		.stats = {
+			.path = stats_arg,
+		},
 	};
+	wl_list_init(&state.heads);
+	wl_list_init(&state.pending_configs);
+	wl_list_init(&state.timers);
+	wl_list_init(&state.flaps);
+	kanshi_timer_init(&state.retry_timer, handle_retry_timer, NULL);
+	// Keep enough objects for a dock re-enumerating its heads and modes
+	kanshi_pool_init(&state.pools[KANSHI_POOL_HEADS],
+		sizeof(struct kanshi_head), HEADS_MAX,
+		&state.stats.pools[KANSHI_POOL_HEADS]);
+	kanshi_pool_init(&state.pools[KANSHI_POOL_MODES],
+		sizeof(struct kanshi_mode), 1024,
+		&state.stats.pools[KANSHI_POOL_MODES]);
+	kanshi_pool_init(&state.pools[KANSHI_POOL_PENDING_PROFILES],
+		sizeof(struct kanshi_pending_profile), 8,
+		&state.stats.pools[KANSHI_POOL_PENDING_PROFILES]);
 	int ret = EXIT_SUCCESS;
+
+	if (match_threads > 0) {
+		state.match_pool = match_pool_create(match_threads);
+		if (state.match_pool == NULL) {
+			return EXIT_FAILURE;
+		}
+	}
+
+	// Parse the config while the compositor processes the registry request
+	if (!connect_display(&state)) {
+		return EXIT_FAILURE;
+	}
+
+	uint64_t parse_start_ns = kanshi_stats_now();
+	struct kanshi_config *config = read_config(config_arg);
+	if (config == NULL || !set_config(&state, config)) {
+		kanshi_disconnect(&state);
+		return EXIT_FAILURE;
+	}
+	state.stats.parse_ns = kanshi_stats_now() - parse_start_ns;
+	kanshi_load_layout(&state);
+
+	if (record_arg != NULL && kanshi_init_record(&state, record_arg) != 0) {
+		ret = EXIT_FAILURE;
+		goto done;
+	}
+	// The status file is optional
+	kanshi_init_status(&state);
 #if KANSHI_HAS_VARLINK
 	if (kanshi_init_ipc(&state, listen_fd) != 0) {
 		ret = EXIT_FAILURE;
 		goto done;
 	}
 #endif
-	wl_list_init(&state.heads);
 
-	struct wl_registry *registry = wl_display_get_registry(display);
-	wl_registry_add_listener(registry, &registry_listener, &state);
-	if (wl_display_roundtrip(display) < 0) {
-		fprintf(stderr, "wl_display_roundtrip() failed\n");
-		return EXIT_FAILURE;
-	}
-
-	if (state.output_manager == NULL) {
-		fprintf(stderr, "compositor doesn't support "
-			"wlr-output-management-unstable-v1\n");
+	if (!finish_connect(&state)) {
 		ret = EXIT_FAILURE;
 		goto done;
 	}
@@ -738,10 +1317,22 @@ int main(int argc, char *argv[]) {
 	ret = kanshi_main_loop(&state);
 
 done:
+	if (state.display != NULL) {
+		kanshi_disconnect(&state);
+	}
 #if KANSHI_HAS_VARLINK
 	kanshi_free_ipc(&state);
 #endif
-	wl_display_disconnect(display);
+	kanshi_free_status(&state);
+	kanshi_free_record(&state);
+	kanshi_free_layout(&state);
+	kanshi_free_damping(&state);
+	matcher_destroy(state.matcher);
+	match_pool_destroy(state.match_pool);
+	for (size_t i = 0; i < KANSHI_POOL_COUNT; i++) {
+		kanshi_pool_finish(&state.pools[i]);
+	}
+	kanshi_log_finish();
 
 	return ret;
 }
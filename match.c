@@ -0,0 +1,804 @@
+#define _POSIX_C_SOURCE 200809L
+#include <assert.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "compile.h"
+#include "config.h"
+#include "kanshi.h"
+#include "match.h"
+
+static void head_identifier(struct kanshi_head *head, char identifier[1024]) {
+	const char *make = head->make ? head->make : "Unknown";
+	const char *model = head->model ? head->model : "Unknown";
+	const char *serial_number =
+		head->serial_number ? head->serial_number : "Unknown";
+
+	assert(1024 >= strlen(make) + strlen(model) + strlen(serial_number) + 3);
+	snprintf(identifier, 1024, "%s %s %s", make, model, serial_number);
+}
+
+static bool match_pattern_str(const struct kanshi_output_pattern *pattern,
+		const char *str) {
+	if (str == NULL) {
+		return false;
+	}
+	switch (pattern->type) {
+	case KANSHI_PATTERN_GLOB:
+		return fnmatch(pattern->glob, str, 0) == 0;
+	case KANSHI_PATTERN_REGEX:
+		return regexec(&pattern->regex, str, 0, NULL, 0) == 0;
+	}
+	abort();
+}
+
+// Patterns are tried against the name, the identifier and the description
+static bool match_pattern(const struct kanshi_output_pattern *pattern,
+		struct kanshi_head *head, const char *identifier) {
+	return match_pattern_str(pattern, head->name) ||
+		match_pattern_str(pattern, identifier) ||
+		match_pattern_str(pattern, head->description);
+}
+
+bool match_profile_output(struct kanshi_profile_output *output,
+		struct kanshi_head *head) {
+	char identifier[1024];
+	head_identifier(head, identifier);
+
+	if (output->pattern != NULL) {
+		return match_pattern(output->pattern, head, identifier);
+	}
+
+	return strcmp(output->name, "*") == 0 ||
+		strcmp(output->name, head->name) == 0 ||
+		strcmp(output->name, identifier) == 0;
+}
+
+bool match_profile(struct wl_list *heads, struct kanshi_profile *profile,
+		struct kanshi_profile_output *matches[static HEADS_MAX]) {
+	// Damped heads are left out of matching, but still have a slot in
+	// matches
+	int heads_len = 0, slots_len = 0;
+	struct kanshi_head *head;
+	wl_list_for_each(head, heads, link) {
+		slots_len++;
+		if (!head->damped) {
+			heads_len++;
+		}
+	}
+	if (slots_len > HEADS_MAX) {
+		return false;
+	}
+	int outputs_len = 0, required_len = 0;
+	struct kanshi_profile_output *profile_output;
+	wl_list_for_each(profile_output, &profile->outputs, link) {
+		outputs_len++;
+		if (!profile_output->optional) {
+			required_len++;
+		}
+	}
+	if (heads_len < required_len || (heads_len > outputs_len &&
+			profile->unlisted == KANSHI_UNLISTED_NONE)) {
+		return false;
+	}
+
+	memset(matches, 0, HEADS_MAX * sizeof(struct kanshi_head *));
+
+	// Required outputs are matched before optional ones. Exact names are
+	// stored first, then patterns, then wildcards, so the most specific
+	// outputs are matched first.
+	int matched_len = 0;
+	for (int pass = 0; pass < 2; pass++) {
+		bool optional = pass == 1;
+		wl_list_for_each(profile_output, &profile->outputs, link) {
+			if (profile_output->optional != optional) {
+				continue;
+			}
+
+			bool output_matched = false;
+			ssize_t i = -1;
+			wl_list_for_each(head, heads, link) {
+				i++;
+
+				if (matches[i] != NULL || head->damped) {
+					continue; // already matched
+				}
+
+				if (match_profile_output(profile_output, head)) {
+					matches[i] = profile_output;
+					output_matched = true;
+					matched_len++;
+					break;
+				}
+			}
+
+			if (!output_matched && !optional) {
+				return false;
+			}
+		}
+	}
+
+	return matched_len == heads_len ||
+		profile->unlisted != KANSHI_UNLISTED_NONE;
+}
+
+// Interned IDs of the undamped heads, and their index in the head list
+struct match_heads {
+	size_t len;
+	uint32_t name_ids[HEADS_MAX], identifier_ids[HEADS_MAX];
+	int indexes[HEADS_MAX];
+	struct kanshi_head *heads[HEADS_MAX];
+};
+
+// Returns false if there are more than HEADS_MAX heads
+static bool resolve_heads(const struct kanshi_compiled_config *compiled,
+		struct wl_list *heads, struct match_heads *resolved) {
+	resolved->len = 0;
+	int i = -1;
+	struct kanshi_head *head;
+	wl_list_for_each(head, heads, link) {
+		i++;
+		if (i >= HEADS_MAX) {
+			return false;
+		}
+		if (head->damped) {
+			continue;
+		}
+
+		char identifier[1024];
+		head_identifier(head, identifier);
+
+		size_t n = resolved->len++;
+		resolved->name_ids[n] = compiled_config_lookup(compiled, head->name);
+		resolved->identifier_ids[n] =
+			compiled_config_lookup(compiled, identifier);
+		resolved->indexes[n] = i;
+		resolved->heads[n] = head;
+	}
+	return true;
+}
+
+// Returns the first head not in used whose ID is id, or len
+static size_t find_head(const uint32_t ids[static HEADS_MAX], uint64_t used,
+		size_t len, uint32_t id) {
+	for (size_t j = 0; j < len; j++) {
+		if (ids[j] == id && !(used >> j & 1)) {
+			return j;
+		}
+	}
+	return len;
+}
+
+// Same as match_profile, over the compiled profile
+static bool match_compiled_profile(const struct kanshi_compiled_config *compiled,
+		const struct kanshi_compiled_profile *profile,
+		const struct match_heads *heads,
+		struct kanshi_profile_output *matches[static HEADS_MAX]) {
+	bool strict = profile->unlisted == KANSHI_UNLISTED_NONE;
+	if (heads->len < profile->required_len ||
+			(strict && heads->len > profile->outputs_len)) {
+		return false;
+	}
+
+	// matched[j] is the output matched to the j-th undamped head
+	const struct kanshi_compiled_output *matched[HEADS_MAX];
+	size_t matched_len = 0;
+	uint64_t used = 0; // bit j is set if matched[j] is
+	const struct kanshi_compiled_output *output =
+		&compiled->outputs[profile->outputs_offset];
+	for (uint32_t k = 0; k < profile->outputs_len; k++, output++) {
+		size_t j = heads->len;
+		switch ((enum kanshi_compiled_criterion)output->criterion) {
+		case KANSHI_CRITERION_WILDCARD:
+			for (j = 0; j < heads->len && (used >> j & 1); j++) {
+				// Find the first unmatched head
+			}
+			break;
+		case KANSHI_CRITERION_IDENTIFIER:
+			// The first head matching either, like match_profile_output
+			j = find_head(heads->identifier_ids, used, heads->len,
+				output->id);
+			size_t by_name = find_head(heads->name_ids, used, heads->len,
+				output->id);
+			if (by_name < j) {
+				j = by_name;
+			}
+			break;
+		case KANSHI_CRITERION_NAME:
+			j = find_head(heads->name_ids, used, heads->len, output->id);
+			break;
+		case KANSHI_CRITERION_PATTERN:
+			for (j = 0; j < heads->len; j++) {
+				if (used >> j & 1) {
+					continue;
+				}
+				char identifier[1024];
+				head_identifier(heads->heads[j], identifier);
+				if (match_pattern(output->output->pattern, heads->heads[j],
+						identifier)) {
+					break;
+				}
+			}
+			break;
+		}
+		if (j == heads->len) {
+			if (k < profile->required_len) {
+				return false;
+			}
+			continue; // optional
+		}
+		matched[j] = output;
+		used |= UINT64_C(1) << j;
+		matched_len++;
+	}
+	if (strict && matched_len != heads->len) {
+		return false;
+	}
+
+	memset(matches, 0, HEADS_MAX * sizeof(struct kanshi_head *));
+	for (size_t j = 0; j < heads->len; j++) {
+		if (used >> j & 1) {
+			matches[heads->indexes[j]] = matched[j]->output;
+		}
+	}
+	return true;
+}
+
+struct kanshi_profile *match(struct kanshi_config *config,
+		struct wl_list *heads,
+		struct kanshi_profile_output *matches[static HEADS_MAX]) {
+	const struct kanshi_compiled_config *compiled = config->compiled;
+	struct match_heads resolved;
+	if (!resolve_heads(compiled, heads, &resolved)) {
+		return NULL;
+	}
+
+	for (size_t i = 0; i < compiled->profiles_len; i++) {
+		const struct kanshi_compiled_profile *profile = &compiled->profiles[i];
+		if (match_compiled_profile(compiled, profile, &resolved, matches)) {
+			return profile->profile;
+		}
+	}
+	return NULL;
+}
+
+// Profiles are handed out to the pool threads in chunks of this size
+#define MATCH_POOL_CHUNK 64
+
+struct match_job {
+	const struct kanshi_compiled_config *compiled;
+	const struct match_heads *heads;
+	const uint32_t *candidates; // profile indexes, NULL for all profiles
+	size_t len;
+
+	// Protected by the pool lock
+	size_t next_chunk;
+	size_t best; // position of the earliest match, len if none yet
+	struct kanshi_profile_output *matches[HEADS_MAX];
+};
+
+struct kanshi_match_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t work, done;
+	pthread_t *threads;
+	int threads_len;
+
+	struct match_job *job;
+	uint64_t generation; // incremented for each job
+	int busy; // threads still working on the job
+	bool stopping;
+};
+
+static void run_job(struct kanshi_match_pool *pool, struct match_job *job) {
+	struct kanshi_profile_output *matches[HEADS_MAX];
+	for (;;) {
+		// Chunks are claimed in file order, so once a match is found later
+		// chunks can be skipped
+		pthread_mutex_lock(&pool->lock);
+		size_t start = job->next_chunk++ * MATCH_POOL_CHUNK;
+		bool cancelled = start >= job->len || start > job->best;
+		pthread_mutex_unlock(&pool->lock);
+		if (cancelled) {
+			return;
+		}
+
+		size_t end = start + MATCH_POOL_CHUNK;
+		if (end > job->len) {
+			end = job->len;
+		}
+		for (size_t i = start; i < end; i++) {
+			uint32_t p = job->candidates != NULL ? job->candidates[i] : i;
+			if (!match_compiled_profile(job->compiled,
+					&job->compiled->profiles[p], job->heads, matches)) {
+				continue;
+			}
+			pthread_mutex_lock(&pool->lock);
+			if (i < job->best) {
+				job->best = i;
+				memcpy(job->matches, matches, sizeof(matches));
+			}
+			pthread_mutex_unlock(&pool->lock);
+			break;
+		}
+	}
+}
+
+static void *pool_thread(void *data) {
+	struct kanshi_match_pool *pool = data;
+	uint64_t generation = 0;
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		while (!pool->stopping && pool->generation == generation) {
+			pthread_cond_wait(&pool->work, &pool->lock);
+		}
+		if (pool->stopping) {
+			break;
+		}
+		generation = pool->generation;
+		struct match_job *job = pool->job;
+		pthread_mutex_unlock(&pool->lock);
+
+		run_job(pool, job);
+
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->busy == 0) {
+			pthread_cond_signal(&pool->done);
+		}
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+struct kanshi_match_pool *match_pool_create(int threads) {
+	struct kanshi_match_pool *pool = calloc(1, sizeof(*pool));
+	if (pool == NULL) {
+		return NULL;
+	}
+	pool->threads = calloc(threads, sizeof(*pool->threads));
+	if (pool->threads == NULL) {
+		free(pool);
+		return NULL;
+	}
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work, NULL);
+	pthread_cond_init(&pool->done, NULL);
+
+	// Signals are handled by the main thread
+	sigset_t set, old_set;
+	sigfillset(&set);
+	pthread_sigmask(SIG_SETMASK, &set, &old_set);
+	for (int i = 0; i < threads; i++) {
+		int ret = pthread_create(&pool->threads[i], NULL, pool_thread, pool);
+		if (ret != 0) {
+			fprintf(stderr, "failed to create match thread: %s\n",
+				strerror(ret));
+			break;
+		}
+		pool->threads_len++;
+	}
+	pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+
+	if (pool->threads_len != threads) {
+		match_pool_destroy(pool);
+		return NULL;
+	}
+	return pool;
+}
+
+void match_pool_destroy(struct kanshi_match_pool *pool) {
+	if (pool == NULL) {
+		return;
+	}
+	pthread_mutex_lock(&pool->lock);
+	pool->stopping = true;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+	for (int i = 0; i < pool->threads_len; i++) {
+		pthread_join(pool->threads[i], NULL);
+	}
+	pthread_cond_destroy(&pool->work);
+	pthread_cond_destroy(&pool->done);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->threads);
+	free(pool);
+}
+
+// Returns the position of the earliest matching candidate, or len
+static size_t pool_run(struct kanshi_match_pool *pool,
+		const struct kanshi_compiled_config *compiled,
+		const struct match_heads *heads, const uint32_t *candidates,
+		size_t len, struct kanshi_profile_output *matches[static HEADS_MAX]) {
+	struct match_job job = {
+		.compiled = compiled,
+		.heads = heads,
+		.candidates = candidates,
+		.len = len,
+		.best = len,
+	};
+
+	pthread_mutex_lock(&pool->lock);
+	pool->job = &job;
+	pool->generation++;
+	pool->busy = pool->threads_len;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+
+	// The calling thread takes its share of the chunks
+	run_job(pool, &job);
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->busy > 0) {
+		pthread_cond_wait(&pool->done, &pool->lock);
+	}
+	pool->job = NULL;
+	pthread_mutex_unlock(&pool->lock);
+
+	if (job.best < len) {
+		memcpy(matches, job.matches, sizeof(job.matches));
+	}
+	return job.best;
+}
+
+struct kanshi_profile *match_pool_match(struct kanshi_match_pool *pool,
+		struct kanshi_config *config, struct wl_list *heads,
+		struct kanshi_profile_output *matches[static HEADS_MAX]) {
+	const struct kanshi_compiled_config *compiled = config->compiled;
+	struct match_heads resolved;
+	if (!resolve_heads(compiled, heads, &resolved)) {
+		return NULL;
+	}
+
+	size_t best = pool_run(pool, compiled, &resolved, NULL,
+		compiled->profiles_len, matches);
+	return best < compiled->profiles_len ?
+		compiled->profiles[best].profile : NULL;
+}
+
+// Profiles which only match a given number of heads are bucketed by that
+// number, the others are kept together. Returns NULL for profiles which can
+// never match.
+static struct kanshi_matcher_bucket *get_bucket(
+		struct kanshi_matcher *matcher, uint32_t p) {
+	const struct kanshi_compiled_profile *profile =
+		&matcher->compiled->profiles[p];
+	if (profile->required_len > HEADS_MAX) {
+		return NULL;
+	}
+	if (profile->required_len != profile->outputs_len ||
+			profile->unlisted != KANSHI_UNLISTED_NONE) {
+		return &matcher->flexible;
+	}
+	return &matcher->buckets[profile->outputs_len];
+}
+
+struct kanshi_matcher *matcher_create(
+		const struct kanshi_compiled_config *compiled) {
+	struct kanshi_matcher *matcher = calloc(1, sizeof(*matcher));
+	if (matcher == NULL) {
+		return NULL;
+	}
+	matcher->compiled = compiled;
+
+	size_t ids_len = compiled->names_len + 1;
+	size_t profiles_len = compiled->profiles_len;
+	matcher->present = calloc(ids_len, sizeof(*matcher->present));
+	matcher->ref_offsets = calloc(ids_len + 1, sizeof(*matcher->ref_offsets));
+	matcher->refs = calloc(compiled->outputs_len + 1, sizeof(*matcher->refs));
+	matcher->unsatisfied = calloc(profiles_len + 1,
+		sizeof(*matcher->unsatisfied));
+	matcher->bucket_index = calloc(profiles_len + 1,
+		sizeof(*matcher->bucket_index));
+	if (matcher->present == NULL || matcher->ref_offsets == NULL ||
+			matcher->refs == NULL || matcher->unsatisfied == NULL ||
+			matcher->bucket_index == NULL) {
+		goto error;
+	}
+
+	// Group the profiles referencing each ID with a required output,
+	// counting sort by ID
+	for (uint32_t p = 0; p < profiles_len; p++) {
+		const struct kanshi_compiled_profile *profile = &compiled->profiles[p];
+		for (uint32_t k = 0; k < profile->required_len; k++) {
+			uint32_t id = compiled->outputs[profile->outputs_offset + k].id;
+			matcher->ref_offsets[id + 1]++;
+		}
+	}
+	for (size_t id = 0; id < ids_len; id++) {
+		matcher->ref_offsets[id + 1] += matcher->ref_offsets[id];
+	}
+	uint32_t *fill = calloc(ids_len, sizeof(*fill));
+	if (fill == NULL) {
+		goto error;
+	}
+	for (uint32_t p = 0; p < profiles_len; p++) {
+		const struct kanshi_compiled_profile *profile = &compiled->profiles[p];
+		for (uint32_t k = 0; k < profile->required_len; k++) {
+			uint32_t id = compiled->outputs[profile->outputs_offset + k].id;
+			matcher->refs[matcher->ref_offsets[id] + fill[id]++] = p;
+			if (id != COMPILED_ID_NONE) {
+				// No head is counted yet
+				matcher->unsatisfied[p]++;
+			}
+		}
+	}
+	free(fill);
+
+	// Bucket the profiles, in file order
+	for (uint32_t p = 0; p < profiles_len; p++) {
+		struct kanshi_matcher_bucket *bucket = get_bucket(matcher, p);
+		if (bucket != NULL) {
+			matcher->bucket_index[p] = bucket->len++;
+		}
+	}
+	for (size_t n = 0; n <= HEADS_MAX + 1; n++) {
+		struct kanshi_matcher_bucket *bucket = n <= HEADS_MAX ?
+			&matcher->buckets[n] : &matcher->flexible;
+		if (bucket->len == 0) {
+			continue;
+		}
+		bucket->profiles = calloc(bucket->len, sizeof(*bucket->profiles));
+		bucket->ready = calloc((bucket->len + 63) / 64,
+			sizeof(*bucket->ready));
+		if (bucket->profiles == NULL || bucket->ready == NULL) {
+			goto error;
+		}
+	}
+	for (uint32_t p = 0; p < profiles_len; p++) {
+		struct kanshi_matcher_bucket *bucket = get_bucket(matcher, p);
+		if (bucket == NULL) {
+			continue;
+		}
+		uint32_t b = matcher->bucket_index[p];
+		bucket->profiles[b] = p;
+		if (matcher->unsatisfied[p] == 0) {
+			bucket->ready[b / 64] |= UINT64_C(1) << (b % 64);
+		}
+	}
+
+	return matcher;
+
+error:
+	matcher_destroy(matcher);
+	return NULL;
+}
+
+void matcher_destroy(struct kanshi_matcher *matcher) {
+	if (matcher == NULL) {
+		return;
+	}
+	for (size_t n = 0; n <= HEADS_MAX; n++) {
+		free(matcher->buckets[n].profiles);
+		free(matcher->buckets[n].ready);
+	}
+	free(matcher->flexible.profiles);
+	free(matcher->flexible.ready);
+	free(matcher->present);
+	free(matcher->ref_offsets);
+	free(matcher->refs);
+	free(matcher->unsatisfied);
+	free(matcher->bucket_index);
+	free(matcher);
+}
+
+static void set_ready(struct kanshi_matcher *matcher, uint32_t p, bool ready) {
+	struct kanshi_matcher_bucket *bucket = get_bucket(matcher, p);
+	if (bucket == NULL) {
+		return;
+	}
+	uint32_t b = matcher->bucket_index[p];
+	uint64_t bit = UINT64_C(1) << (b % 64);
+	if (ready) {
+		bucket->ready[b / 64] |= bit;
+	} else {
+		bucket->ready[b / 64] &= ~bit;
+	}
+}
+
+// Updates the profiles referencing id when a head with it comes or goes
+static void update_id(struct kanshi_matcher *matcher, uint32_t id, int delta) {
+	if (id == COMPILED_ID_NONE) {
+		return;
+	}
+	uint32_t present = matcher->present[id];
+	matcher->present[id] += delta;
+	if (present != 0 && matcher->present[id] != 0) {
+		return; // still present
+	}
+
+	for (uint32_t r = matcher->ref_offsets[id];
+			r < matcher->ref_offsets[id + 1]; r++) {
+		uint32_t p = matcher->refs[r];
+		if (delta > 0) {
+			if (--matcher->unsatisfied[p] == 0) {
+				set_ready(matcher, p, true);
+			}
+		} else {
+			if (matcher->unsatisfied[p]++ == 0) {
+				set_ready(matcher, p, false);
+			}
+		}
+	}
+}
+
+void matcher_add_head(struct kanshi_matcher *matcher,
+		struct kanshi_head *head) {
+	if (head->counted) {
+		return;
+	}
+	char identifier[1024];
+	head_identifier(head, identifier);
+	head->counted = true;
+	head->name_id = compiled_config_lookup(matcher->compiled, head->name);
+	head->identifier_id = compiled_config_lookup(matcher->compiled, identifier);
+	matcher->heads_len++;
+
+	update_id(matcher, head->name_id, 1);
+	if (head->identifier_id != head->name_id) {
+		update_id(matcher, head->identifier_id, 1);
+	}
+}
+
+void matcher_remove_head(struct kanshi_matcher *matcher,
+		struct kanshi_head *head) {
+	if (!head->counted) {
+		return;
+	}
+	head->counted = false;
+	matcher->heads_len--;
+
+	update_id(matcher, head->name_id, -1);
+	if (head->identifier_id != head->name_id) {
+		update_id(matcher, head->identifier_id, -1);
+	}
+}
+
+// Returns the first ready index at or after b, or the bucket length
+static size_t next_ready(const struct kanshi_matcher_bucket *bucket, size_t b) {
+	while (b < bucket->len) {
+		uint64_t ready = bucket->ready[b / 64] >> (b % 64);
+		if (ready == 0) {
+			b = (b / 64 + 1) * 64;
+			continue;
+		}
+		while (!(ready & 1)) {
+			ready >>= 1;
+			b++;
+		}
+		return b;
+	}
+	return bucket->len;
+}
+
+// Walks the ready profiles of two buckets in file order
+struct ready_cursor {
+	const struct kanshi_matcher_bucket *exact, *flexible;
+	size_t e, f;
+};
+
+static uint32_t next_candidate(struct ready_cursor *cursor) {
+	bool has_exact = cursor->e < cursor->exact->len;
+	bool has_flexible = cursor->f < cursor->flexible->len;
+	if (has_exact && (!has_flexible || cursor->exact->profiles[cursor->e] <
+			cursor->flexible->profiles[cursor->f])) {
+		uint32_t p = cursor->exact->profiles[cursor->e];
+		cursor->e = next_ready(cursor->exact, cursor->e + 1);
+		return p;
+	}
+	if (has_flexible) {
+		uint32_t p = cursor->flexible->profiles[cursor->f];
+		cursor->f = next_ready(cursor->flexible, cursor->f + 1);
+		return p;
+	}
+	return UINT32_MAX;
+}
+
+struct kanshi_profile *matcher_match(struct kanshi_matcher *matcher,
+		struct wl_list *heads,
+		struct kanshi_profile_output *matches[static HEADS_MAX]) {
+	size_t n = matcher->heads_len;
+	if (n > HEADS_MAX || (matcher->buckets[n].len == 0 &&
+			matcher->flexible.len == 0)) {
+		return NULL;
+	}
+
+	struct match_heads resolved = {0};
+	int i = -1;
+	struct kanshi_head *head;
+	wl_list_for_each(head, heads, link) {
+		i++;
+		if (i >= HEADS_MAX) {
+			return NULL;
+		}
+		if (!head->counted) {
+			continue;
+		}
+		size_t j = resolved.len++;
+		resolved.name_ids[j] = head->name_id;
+		resolved.identifier_ids[j] = head->identifier_id;
+		resolved.indexes[j] = i;
+		resolved.heads[j] = head;
+	}
+	assert(resolved.len == n);
+
+	// Only the profiles for which each required output name is connected
+	// can match, the first one in file order which does wins
+	const struct kanshi_compiled_config *compiled = matcher->compiled;
+	struct ready_cursor cursor = {
+		.exact = &matcher->buckets[n],
+		.flexible = &matcher->flexible,
+	};
+	cursor.e = next_ready(cursor.exact, 0);
+	cursor.f = next_ready(cursor.flexible, 0);
+	size_t max = cursor.exact->len + cursor.flexible->len;
+	if (matcher->pool != NULL && max >= MATCH_POOL_MIN_PROFILES) {
+		uint32_t *candidates = malloc(max * sizeof(*candidates));
+		if (candidates != NULL) {
+			size_t len = 0;
+			uint32_t p;
+			while ((p = next_candidate(&cursor)) != UINT32_MAX) {
+				candidates[len++] = p;
+			}
+			size_t best = pool_run(matcher->pool, compiled, &resolved,
+				candidates, len, matches);
+			struct kanshi_profile *profile = best < len ?
+				compiled->profiles[candidates[best]].profile : NULL;
+			free(candidates);
+			return profile;
+		}
+	}
+	uint32_t p;
+	while ((p = next_candidate(&cursor)) != UINT32_MAX) {
+		const struct kanshi_compiled_profile *profile = &compiled->profiles[p];
+		if (match_compiled_profile(compiled, profile, &resolved, matches)) {
+			return profile->profile;
+		}
+	}
+	return NULL;
+}
+
+static bool match_refresh(const struct kanshi_mode *mode, int refresh, int *delta) {
+	int v = refresh - mode->refresh;
+	int mode_delta = abs(v);
+	/* If we have a refresh, pick one with the lowest delta from our target.
+	 * Doing a simple fuzzy match that picks the greatest (due to ordering) here can lead us to picking a refresh
+	 * such as 120.01 or 60.01, which is problematic for two reasons:
+	 *  - Modes such as 4K 120.01Hz is too much for link bandwidth of DP 1.4 without DSC.
+	 *  - It becomes out of phase with the majority of content being displayed.
+	 */
+	if (mode_delta < 50 && mode_delta < *delta) {
+		*delta = mode_delta;
+		return true;
+	}
+	return false;
+}
+
+struct kanshi_mode *match_mode(struct kanshi_head *head,
+		int width, int height, int refresh) {
+	struct kanshi_mode *mode;
+	struct kanshi_mode *last_match = NULL;
+	int mode_delta = INT32_MAX;
+
+	wl_list_for_each(mode, &head->modes, link) {
+		if (mode->width != width || mode->height != height) {
+			continue;
+		}
+
+		if (refresh) {
+			if (match_refresh(mode, refresh, &mode_delta)) {
+				last_match = mode;
+			}
+		} else {
+			if (!last_match || mode->refresh > last_match->refresh) {
+				last_match = mode;
+			}
+		}
+	}
+
+	return last_match;
+}
@@ -1,6 +1,7 @@
 #define _POSIX_C_SOURCE 200809L
 #include <ctype.h>
 #include <errno.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -9,6 +10,7 @@
 
 #include <wayland-client.h>
 
+#include "compile.h"
 #include "config.h"
 #include "parser.h"
 
@@ -23,7 +25,7 @@ static const char *token_type_str(enum kanshi_token_type t) {
 	case KANSHI_TOKEN_NEWLINE:
 		return "newline";
 	}
-	abort();
+	return "unknown token";
 }
 
 static int parser_read_char(struct kanshi_parser *parser) {
@@ -192,8 +194,9 @@ static bool parser_expect_token(struct kanshi_parser *parser,
 static bool parse_int(int *dst, const char *str) {
 	char *end;
 	errno = 0;
-	int v = strtol(str, &end, 10);
-	if (errno != 0 || end[0] != '\0' || str[0] == '\0') {
+	long v = strtol(str, &end, 10);
+	if (errno != 0 || end[0] != '\0' || str[0] == '\0' ||
+			v < INT_MIN || v > INT_MAX) {
 		return false;
 	}
 	*dst = v;
@@ -224,7 +227,7 @@ static bool parse_mode(struct kanshi_profile_output *output, char *str) {
 		errno = 0;
 		float v = strtof(refresh, &end);
 		if (errno != 0 || (end[0] != '\0' && strcmp(end, "Hz") != 0) ||
-				str[0] == '\0') {
+				refresh[0] == '\0' || !(v >= 0 && v <= INT_MAX / 1000)) {
 			fprintf(stderr, "invalid output mode: invalid refresh rate\n");
 			return false;
 		}
@@ -300,20 +303,153 @@ static bool parse_bool(bool *dst, const char *str) {
 	return true;
 }
 
-static struct kanshi_profile_output *parse_profile_output(
-		struct kanshi_parser *parser) {
-	struct kanshi_profile_output *output = calloc(1, sizeof(*output));
+static void destroy_profile_output(struct kanshi_profile_output *output) {
+	if (output->base == NULL) {
+		if (output->pattern != NULL &&
+				output->pattern->type == KANSHI_PATTERN_REGEX) {
+			regfree(&output->pattern->regex);
+		}
+		free(output->pattern);
+		free(output->name);
+	}
+	free(output);
+}
+
+// The copy shares the name and pattern of base, which must outlive it
+static struct kanshi_profile_output *copy_profile_output(
+		const struct kanshi_profile_output *base) {
+	struct kanshi_profile_output *output = malloc(sizeof(*output));
+	if (output == NULL) {
+		return NULL;
+	}
+	*output = *base;
+	output->base = base;
+	wl_list_init(&output->link);
+	return output;
+}
+
+static struct kanshi_profile_output *find_output_def(
+		struct kanshi_config *config, const char *name) {
+	struct kanshi_profile_output *output;
+	wl_list_for_each(output, &config->outputs, link) {
+		if (strcmp(output->name, name) == 0) {
+			return output;
+		}
+	}
+	return NULL;
+}
+
+static const char glob_prefix[] = "glob:";
+static const char regex_prefix[] = "regex:";
+
+static bool has_prefix(const char *str, const char *prefix) {
+	return strncmp(str, prefix, strlen(prefix)) == 0;
+}
+
+static struct kanshi_output_pattern *parse_pattern(const char *criteria) {
+	struct kanshi_output_pattern *pattern = calloc(1, sizeof(*pattern));
+	if (pattern == NULL) {
+		return NULL;
+	}
+	if (has_prefix(criteria, glob_prefix)) {
+		pattern->type = KANSHI_PATTERN_GLOB;
+		pattern->glob = criteria + strlen(glob_prefix);
+		return pattern;
+	}
 
+	const char *expr = criteria + strlen(regex_prefix);
+	// Regular expressions need to match the whole string, like globs
+	char *anchored = malloc(strlen(expr) + 5);
+	if (anchored == NULL) {
+		free(pattern);
+		return NULL;
+	}
+	sprintf(anchored, "^(%s)$", expr);
+	pattern->type = KANSHI_PATTERN_REGEX;
+	int ret = regcomp(&pattern->regex, anchored, REG_EXTENDED | REG_NOSUB);
+	free(anchored);
+	if (ret != 0) {
+		char msg[256];
+		regerror(ret, &pattern->regex, msg, sizeof(msg));
+		fprintf(stderr, "invalid regular expression '%s': %s\n", expr, msg);
+		free(pattern);
+		return NULL;
+	}
+	return pattern;
+}
+
+static void destroy_profile(struct kanshi_profile *profile) {
+	struct kanshi_profile_output *output, *tmp_output;
+	wl_list_for_each_safe(output, tmp_output, &profile->outputs, link) {
+		wl_list_remove(&output->link);
+		destroy_profile_output(output);
+	}
+	struct kanshi_profile_command *command, *tmp_command;
+	wl_list_for_each_safe(command, tmp_command, &profile->commands, link) {
+		wl_list_remove(&command->link);
+		free(command->command);
+		free(command);
+	}
+	free(profile->name);
+	free(profile);
+}
+
+// Parses an output directive of a profile, or a top-level output definition
+// if profile is NULL. The directive updates the output the profile got from a
+// template with the same criteria, which stays in the profile, or else starts
+// from the output definition with the same criteria.
+static struct kanshi_profile_output *parse_profile_output(
+		struct kanshi_parser *parser, struct kanshi_config *config,
+		struct kanshi_profile *profile) {
 	if (!parser_expect_token(parser, KANSHI_TOKEN_STR)) {
 		return NULL;
 	}
-	output->name = strdup(parser->tok_str);
+
+	struct kanshi_profile_output *def = find_output_def(config, parser->tok_str);
+	if (profile == NULL && def != NULL) {
+		fprintf(stderr, "duplicate output definition '%s'\n", def->name);
+		return NULL;
+	}
+	struct kanshi_profile_output *output = NULL;
+	if (profile != NULL) {
+		struct kanshi_profile_output *other;
+		wl_list_for_each(other, &profile->outputs, link) {
+			if (other->base != NULL && other->base != def &&
+					strcmp(other->name, parser->tok_str) == 0) {
+				output = other;
+				break;
+			}
+		}
+	}
+	if (output == NULL && def != NULL) {
+		output = copy_profile_output(def);
+		if (output == NULL) {
+			return NULL;
+		}
+	} else if (output == NULL) {
+		output = calloc(1, sizeof(*output));
+		if (output == NULL) {
+			return NULL;
+		}
+		wl_list_init(&output->link);
+		output->name = strdup(parser->tok_str);
+		if (output->name == NULL) {
+			goto error;
+		}
+		if (has_prefix(output->name, glob_prefix) ||
+				has_prefix(output->name, regex_prefix)) {
+			output->pattern = parse_pattern(output->name);
+			if (output->pattern == NULL) {
+				goto error;
+			}
+		}
+	}
 
 	bool has_key = false;
 	enum kanshi_output_field key = 0;
 	while (1) {
 		if (!parser_next_token(parser)) {
-			return NULL;
+			goto error;
 		}
 
 		switch (parser->tok_type) {
@@ -323,34 +459,36 @@ static struct kanshi_profile_output *parse_profile_output(
 				switch (key) {
 				case KANSHI_OUTPUT_MODE:
 					if (!parse_mode(output, value)) {
-						return NULL;
+						goto error;
 					}
 					break;
 				case KANSHI_OUTPUT_POSITION:
 					if (!parse_position(output, value)) {
-						return NULL;
+						goto error;
 					}
 					break;
 				case KANSHI_OUTPUT_SCALE:
 					if (!parse_float(&output->scale, value)) {
 						fprintf(stderr, "invalid output scale\n");
-						return NULL;
+						goto error;
 					}
 					break;
 				case KANSHI_OUTPUT_TRANSFORM:
 					if (!parse_transform(&output->transform, value)) {
 						fprintf(stderr, "invalid output transform\n");
-						return NULL;
+						goto error;
 					}
 					break;
 				case KANSHI_OUTPUT_ADAPTIVE_SYNC:
 					if (!parse_bool(&output->adaptive_sync, value)) {
 						fprintf(stderr, "invalid output adaptive_sync\n");
-						return NULL;
+						goto error;
 					}
 					break;
 				default:
-					abort();
+					fprintf(stderr, "unexpected value '%s' in profile output "
+						"'%s'\n", value, output->name);
+					goto error;
 				}
 				has_key = false;
 				output->fields |= key;
@@ -365,6 +503,9 @@ static struct kanshi_profile_output *parse_profile_output(
 					output->enabled = false;
 					output->fields |= KANSHI_OUTPUT_ENABLED;
 					has_key = false;
+				} else if (strcmp(key_str, "optional") == 0) {
+					output->optional = true;
+					has_key = false;
 				} else if (strcmp(key_str, "mode") == 0) {
 					key = KANSHI_OUTPUT_MODE;
 				} else if (strcmp(key_str, "position") == 0) {
@@ -379,18 +520,28 @@ static struct kanshi_profile_output *parse_profile_output(
 					fprintf(stderr,
 						"unknown directive '%s' in profile output '%s'\n",
 						key_str, output->name);
-					return NULL;
+					goto error;
 				}
 			}
 			break;
 		case KANSHI_TOKEN_NEWLINE:
+			if (has_key) {
+				fprintf(stderr, "missing value in profile output '%s'\n",
+					output->name);
+				goto error;
+			}
 			return output;
 		default:
 			fprintf(stderr, "unexpected %s in output\n",
 				token_type_str(parser->tok_type));
-			return NULL;
+			goto error;
 		}
 	}
+
+error:
+	wl_list_remove(&output->link);
+	destroy_profile_output(output);
+	return NULL;
 }
 
 static struct kanshi_profile_command *parse_profile_command(
@@ -415,13 +566,117 @@ static struct kanshi_profile_command *parse_profile_command(
 	return command;
 }
 
-static struct kanshi_profile *parse_profile(struct kanshi_parser *parser) {
+static bool parse_unlisted_policy(struct kanshi_parser *parser,
+		enum kanshi_unlisted_policy *policy) {
+	if (!parser_expect_token(parser, KANSHI_TOKEN_STR)) {
+		return false;
+	}
+	if (strcmp(parser->tok_str, "keep") == 0) {
+		*policy = KANSHI_UNLISTED_KEEP;
+	} else if (strcmp(parser->tok_str, "disable") == 0) {
+		*policy = KANSHI_UNLISTED_DISABLE;
+	} else if (strcmp(parser->tok_str, "auto") == 0) {
+		*policy = KANSHI_UNLISTED_AUTO;
+	} else {
+		fprintf(stderr, "invalid unlisted policy '%s'\n", parser->tok_str);
+		return false;
+	}
+	return parser_expect_token(parser, KANSHI_TOKEN_NEWLINE);
+}
+
+static void insert_profile_output(struct kanshi_profile *profile,
+		struct kanshi_profile_output *output) {
+	// Store wildcard outputs at the end of the list, and patterns right
+	// before them
+	if (strcmp(output->name, "*") == 0) {
+		wl_list_insert(profile->outputs.prev, &output->link);
+	} else if (output->pattern != NULL) {
+		struct wl_list *before = &profile->outputs;
+		struct kanshi_profile_output *other;
+		wl_list_for_each(other, &profile->outputs, link) {
+			if (strcmp(other->name, "*") == 0) {
+				before = &other->link;
+				break;
+			}
+		}
+		wl_list_insert(before->prev, &output->link);
+	} else {
+		wl_list_insert(&profile->outputs, &output->link);
+	}
+}
+
+// Copies the outputs, commands and unlisted policy of a template
+static bool parse_use_template(struct kanshi_parser *parser,
+		struct kanshi_config *config, struct kanshi_profile *profile) {
+	if (!parser_expect_token(parser, KANSHI_TOKEN_STR)) {
+		return false;
+	}
+	struct kanshi_profile *template = NULL, *other;
+	wl_list_for_each(other, &config->templates, link) {
+		if (strcmp(other->name, parser->tok_str) == 0) {
+			template = other;
+			break;
+		}
+	}
+	if (template == NULL) {
+		fprintf(stderr, "unknown template '%s' in profile '%s'\n",
+			parser->tok_str, profile->name);
+		return false;
+	}
+
+	// Exact outputs are inserted at the front, walk them backwards to end up
+	// in the same order as if the template lines were written here
+	struct kanshi_profile_output *template_output;
+	wl_list_for_each_reverse(template_output, &template->outputs, link) {
+		if (strcmp(template_output->name, "*") == 0 ||
+				template_output->pattern != NULL) {
+			continue;
+		}
+		struct kanshi_profile_output *output =
+			copy_profile_output(template_output);
+		if (output == NULL) {
+			return false;
+		}
+		insert_profile_output(profile, output);
+	}
+	wl_list_for_each(template_output, &template->outputs, link) {
+		if (strcmp(template_output->name, "*") != 0 &&
+				template_output->pattern == NULL) {
+			continue;
+		}
+		struct kanshi_profile_output *output =
+			copy_profile_output(template_output);
+		if (output == NULL) {
+			return false;
+		}
+		insert_profile_output(profile, output);
+	}
+	struct kanshi_profile_command *template_command;
+	wl_list_for_each(template_command, &template->commands, link) {
+		struct kanshi_profile_command *command = calloc(1, sizeof(*command));
+		if (command == NULL) {
+			return false;
+		}
+		command->command = strdup(template_command->command);
+		wl_list_insert(profile->commands.prev, &command->link);
+	}
+	if (template->unlisted != KANSHI_UNLISTED_NONE) {
+		profile->unlisted = template->unlisted;
+	}
+	return parser_expect_token(parser, KANSHI_TOKEN_NEWLINE);
+}
+
+static struct kanshi_profile *parse_profile(struct kanshi_parser *parser,
+		struct kanshi_config *config) {
 	struct kanshi_profile *profile = calloc(1, sizeof(*profile));
+	if (profile == NULL) {
+		return NULL;
+	}
 	wl_list_init(&profile->outputs);
 	wl_list_init(&profile->commands);
 
 	if (!parser_next_token(parser)) {
-		return NULL;
+		goto error;
 	}
 
 	switch (parser->tok_type) {
@@ -431,12 +686,13 @@ static struct kanshi_profile *parse_profile(struct kanshi_parser *parser) {
 		// Parse an optional profile name
 		profile->name = strdup(parser->tok_str);
 		if (!parser_expect_token(parser, KANSHI_TOKEN_LBRACKET)) {
-			return NULL;
+			goto error;
 		}
 		break;
 	default:
 		fprintf(stderr, "unexpected %s, expected '{' or a profile name\n",
 			token_type_str(parser->tok_type));
+		goto error;
 	}
 
 	// Use the bracket position to generate a default profile name
@@ -454,7 +710,7 @@ static struct kanshi_profile *parse_profile(struct kanshi_parser *parser) {
 	// Parse the profile commands until the closing bracket
 	while (1) {
 		if (!parser_next_token(parser)) {
-			return NULL;
+			goto error;
 		}
 
 		switch (parser->tok_type) {
@@ -464,28 +720,33 @@ static struct kanshi_profile *parse_profile(struct kanshi_parser *parser) {
 			const char *directive = parser->tok_str;
 			if (strcmp(directive, "output") == 0) {
 				struct kanshi_profile_output *output =
-					parse_profile_output(parser);
+					parse_profile_output(parser, config, profile);
 				if (output == NULL) {
-					return NULL;
+					goto error;
 				}
-				// Store wildcard outputs at the end of the list
-				if (strcmp(output->name, "*") == 0) {
-					wl_list_insert(profile->outputs.prev, &output->link);
-				} else {
-					wl_list_insert(&profile->outputs, &output->link);
+				if (wl_list_empty(&output->link)) {
+					insert_profile_output(profile, output);
+				}
+			} else if (strcmp(directive, "use") == 0) {
+				if (!parse_use_template(parser, config, profile)) {
+					goto error;
 				}
 			} else if (strcmp(directive, "exec") == 0) {
 				struct kanshi_profile_command *command =
 					parse_profile_command(parser);
 				if (command == NULL) {
-					return NULL;
+					goto error;
 				}
 				// Insert commands at the end to preserve order
 				wl_list_insert(profile->commands.prev, &command->link);
+			} else if (strcmp(directive, "unlisted") == 0) {
+				if (!parse_unlisted_policy(parser, &profile->unlisted)) {
+					goto error;
+				}
 			} else {
 				fprintf(stderr, "unknown directive '%s' in profile '%s'\n",
 					directive, profile->name);
-				return NULL;
+				goto error;
 			}
 			break;
 		case KANSHI_TOKEN_NEWLINE:
@@ -493,13 +754,43 @@ static struct kanshi_profile *parse_profile(struct kanshi_parser *parser) {
 		default:
 			fprintf(stderr, "unexpected %s in profile '%s'\n",
 				token_type_str(parser->tok_type), profile->name);
-			return NULL;
+			goto error;
 		}
 	}
+
+error:
+	destroy_profile(profile);
+	return NULL;
 }
 
 static bool parse_config_file(const char *path, struct kanshi_config *config);
 
+static bool parse_template(struct kanshi_parser *parser,
+		struct kanshi_config *config) {
+	int ch;
+	while ((ch = parser_peek_char(parser)) == ' ' || ch == '\t') {
+		parser_read_char(parser);
+	}
+	if (ch == '{') {
+		fprintf(stderr, "templates need a name\n");
+		return false;
+	}
+	struct kanshi_profile *template = parse_profile(parser, config);
+	if (template == NULL) {
+		return false;
+	}
+	struct kanshi_profile *other;
+	wl_list_for_each(other, &config->templates, link) {
+		if (strcmp(other->name, template->name) == 0) {
+			fprintf(stderr, "duplicate template '%s'\n", template->name);
+			destroy_profile(template);
+			return false;
+		}
+	}
+	wl_list_insert(config->templates.prev, &template->link);
+	return true;
+}
+
 static bool parse_include_command(struct kanshi_parser *parser, struct kanshi_config *config) {
 	// Skip the 'include' directive.
 	if (!parser_expect_token(parser, KANSHI_TOKEN_STR)) {
@@ -549,7 +840,7 @@ static bool _parse_config(struct kanshi_parser *parser, struct kanshi_config *co
 
 		if (ch == '{') {
 			// Legacy profile syntax without a profile directive
-			struct kanshi_profile *profile = parse_profile(parser);
+			struct kanshi_profile *profile = parse_profile(parser, config);
 			if (!profile) {
 				return false;
 			}
@@ -561,12 +852,27 @@ static bool _parse_config(struct kanshi_parser *parser, struct kanshi_config *co
 
 			const char *directive = parser->tok_str;
 			if (strcmp(parser->tok_str, "profile") == 0) {
-				struct kanshi_profile *profile = parse_profile(parser);
+				struct kanshi_profile *profile = parse_profile(parser, config);
 				if (!profile) {
 					return false;
 				}
 				wl_list_insert(config->profiles.prev, &profile->link);
+			} else if (strcmp(parser->tok_str, "output") == 0) {
+				struct kanshi_profile_output *output =
+					parse_profile_output(parser, config, NULL);
+				if (output == NULL) {
+					return false;
+				}
+				wl_list_insert(config->outputs.prev, &output->link);
+			} else if (strcmp(parser->tok_str, "template") == 0) {
+				if (!parse_template(parser, config)) {
+					return false;
+				}
 			} else if (strcmp(parser->tok_str, "include") == 0) {
+				if (!parser->allow_include) {
+					fprintf(stderr, "include directives are not allowed here\n");
+					return false;
+				}
 				if (!parse_include_command(parser, config)) {
 					return false;
 				}
@@ -578,24 +884,16 @@ static bool _parse_config(struct kanshi_parser *parser, struct kanshi_config *co
 	}
 }
 
-static bool parse_config_file(const char *path, struct kanshi_config *config) {
-	FILE *f = fopen(path, "r");
-	if (f == NULL) {
-		fprintf(stderr, "failed to open file %s: %s\n",
-			path,
-			strerror(errno));
-		return false;
-	}
-
+static bool parse_config_stream(FILE *f, struct kanshi_config *config,
+		bool allow_include) {
 	struct kanshi_parser parser = {
 		.f = f,
 		.next = -1,
 		.line = 1,
+		.allow_include = allow_include,
 	};
 
-	bool res = _parse_config(&parser, config);
-	fclose(f);
-	if (!res) {
+	if (!_parse_config(&parser, config)) {
 		fprintf(stderr, "failed to parse config file: "
 			"error on line %d, column %d\n", parser.line, parser.col);
 		return false;
@@ -604,17 +902,91 @@ static bool parse_config_file(const char *path, struct kanshi_config *config) {
 	return true;
 }
 
-struct kanshi_config *parse_config(const char *path) {
+static bool parse_config_file(const char *path, struct kanshi_config *config) {
+	FILE *f = fopen(path, "r");
+	if (f == NULL) {
+		fprintf(stderr, "failed to open file %s: %s\n",
+			path,
+			strerror(errno));
+		return false;
+	}
+
+	bool res = parse_config_stream(f, config, true);
+	fclose(f);
+	return res;
+}
+
+static struct kanshi_config *create_config(void) {
 	struct kanshi_config *config = calloc(1, sizeof(*config));
 	if (config == NULL) {
 		return NULL;
 	}
 	wl_list_init(&config->profiles);
+	wl_list_init(&config->outputs);
+	wl_list_init(&config->templates);
+	return config;
+}
 
-	if (!parse_config_file(path, config)) {
-		free(config);
+struct kanshi_config *parse_config(const char *path) {
+	struct kanshi_config *config = create_config();
+	if (config == NULL) {
+		return NULL;
+	}
+
+	if (!parse_config_file(path, config) || !compile_config(config)) {
+		destroy_config(config);
 		return NULL;
 	}
 
 	return config;
 }
+
+struct kanshi_config *parse_config_buffer(const char *buf, size_t size) {
+	struct kanshi_config *config = create_config();
+	if (config == NULL) {
+		return NULL;
+	}
+	if (size == 0) {
+		if (!compile_config(config)) {
+			destroy_config(config);
+			return NULL;
+		}
+		return config;
+	}
+
+	FILE *f = fmemopen((void *)buf, size, "r");
+	if (f == NULL) {
+		fprintf(stderr, "fmemopen failed: %s\n", strerror(errno));
+		destroy_config(config);
+		return NULL;
+	}
+
+	bool res = parse_config_stream(f, config, false);
+	fclose(f);
+	if (!res || !compile_config(config)) {
+		destroy_config(config);
+		return NULL;
+	}
+
+	return config;
+}
+
+void destroy_config(struct kanshi_config *config) {
+	struct kanshi_profile *profile, *tmp_profile;
+	wl_list_for_each_safe(profile, tmp_profile, &config->profiles, link) {
+		wl_list_remove(&profile->link);
+		destroy_profile(profile);
+	}
+	// Profiles share the names and patterns of these, destroy them last
+	wl_list_for_each_safe(profile, tmp_profile, &config->templates, link) {
+		wl_list_remove(&profile->link);
+		destroy_profile(profile);
+	}
+	struct kanshi_profile_output *output, *tmp_output;
+	wl_list_for_each_safe(output, tmp_output, &config->outputs, link) {
+		wl_list_remove(&output->link);
+		destroy_profile_output(output);
+	}
+	destroy_compiled_config(config->compiled);
+	free(config);
+}
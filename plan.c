@@ -0,0 +1,64 @@
+#include <stdbool.h>
+
+#include "config.h"
+#include "kanshi.h"
+#include "match.h"
+#include "plan.h"
+
+static void plan_unlisted_head(const struct kanshi_profile *profile,
+		struct kanshi_head *head, struct kanshi_head_plan *plan) {
+	if (head->damped || profile->unlisted == KANSHI_UNLISTED_NONE ||
+			profile->unlisted == KANSHI_UNLISTED_KEEP) {
+		// The protocol requires all heads to be configured, leave
+		// damped and unlisted heads in their current state
+		plan->state.enabled = head->enabled;
+		return;
+	}
+
+	plan->state.enabled = profile->unlisted == KANSHI_UNLISTED_AUTO;
+	if (!plan->state.enabled) {
+		return;
+	}
+	struct kanshi_mode *mode;
+	wl_list_for_each(mode, &head->modes, link) {
+		if (mode->preferred) {
+			plan->fields |= KANSHI_OUTPUT_MODE;
+			plan->state.mode = mode;
+			break;
+		}
+	}
+}
+
+bool plan_head(const struct kanshi_profile *profile,
+		const struct kanshi_profile_output *output, struct kanshi_head *head,
+		struct kanshi_head_plan *plan) {
+	*plan = (struct kanshi_head_plan){0};
+	if (output == NULL) {
+		plan_unlisted_head(profile, head, plan);
+		return true;
+	}
+
+	plan->state.enabled = head->enabled;
+	if (output->fields & KANSHI_OUTPUT_ENABLED) {
+		plan->state.enabled = output->enabled;
+	}
+	if (!plan->state.enabled) {
+		return true;
+	}
+
+	plan->fields = output->fields & ~KANSHI_OUTPUT_ENABLED;
+	if (output->fields & KANSHI_OUTPUT_MODE) {
+		// TODO: support custom modes
+		plan->state.mode = match_mode(head, output->mode.width,
+			output->mode.height, output->mode.refresh);
+		if (plan->state.mode == NULL) {
+			return false;
+		}
+	}
+	plan->state.x = output->position.x;
+	plan->state.y = output->position.y;
+	plan->state.scale = output->scale;
+	plan->state.transform = output->transform;
+	plan->state.adaptive_sync = output->adaptive_sync;
+	return true;
+}
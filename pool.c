@@ -0,0 +1,65 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "pool.h"
+
+// Header of the objects in the free list
+struct pool_free_object {
+	struct pool_free_object *next;
+};
+
+void kanshi_pool_init(struct kanshi_pool *pool, size_t size, size_t max_free,
+		struct kanshi_pool_stats *stats) {
+	if (size < sizeof(struct pool_free_object)) {
+		size = sizeof(struct pool_free_object);
+	}
+	*pool = (struct kanshi_pool){
+		.size = size,
+		.max_free = max_free,
+		.stats = stats,
+	};
+}
+
+void *kanshi_pool_alloc(struct kanshi_pool *pool) {
+	struct pool_free_object *object = pool->free;
+	if (object != NULL) {
+		pool->free = object->next;
+		pool->stats->free--;
+		pool->stats->reuses++;
+		memset(object, 0, pool->size);
+	} else {
+		object = calloc(1, pool->size);
+		if (object == NULL) {
+			return NULL;
+		}
+		pool->stats->mallocs++;
+	}
+	pool->stats->in_use++;
+	return object;
+}
+
+void kanshi_pool_free(struct kanshi_pool *pool, void *object) {
+	if (object == NULL) {
+		return;
+	}
+	pool->stats->in_use--;
+	if (pool->stats->free >= pool->max_free) {
+		free(object);
+		return;
+	}
+	struct pool_free_object *free_object = object;
+	free_object->next = pool->free;
+	pool->free = free_object;
+	pool->stats->free++;
+}
+
+void kanshi_pool_finish(struct kanshi_pool *pool) {
+	struct pool_free_object *object = pool->free;
+	while (object != NULL) {
+		struct pool_free_object *next = object->next;
+		free(object);
+		object = next;
+	}
+	pool->free = NULL;
+	pool->stats->free = 0;
+}
@@ -0,0 +1,240 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "kanshi.h"
+#include "log.h"
+#include "record.h"
+
+// Time after which a replay fails if kanshi doesn't apply a configuration
+#define RECORD_APPLY_TIMEOUT_MS 10000
+
+struct kanshi_record {
+	FILE *f;
+	uint64_t last_ns;
+};
+
+// Last head state written to the trace
+struct kanshi_record_head {
+	int modes;
+	bool enabled;
+	struct kanshi_mode *mode;
+	int32_t x, y;
+	enum wl_output_transform transform;
+	double scale;
+	bool adaptive_sync;
+};
+
+static uint64_t get_time_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void record_wait(struct kanshi_record *record) {
+	uint64_t ms = (get_time_ns() - record->last_ns) / 1000000;
+	if (ms > 0) {
+		fprintf(record->f, "wait %" PRIu64 "\n", ms);
+		record->last_ns += ms * 1000000;
+	}
+}
+
+static void record_string(FILE *f, const char *str) {
+	fputc('"', f);
+	for (const char *p = str; *p != '\0'; p++) {
+		if (*p == '"' || *p == '\\') {
+			fputc('\\', f);
+			fputc(*p, f);
+		} else if (*p == '\n') {
+			fputs("\\n", f);
+		} else {
+			fputc(*p, f);
+		}
+	}
+	fputc('"', f);
+}
+
+static void record_mode(FILE *f, struct kanshi_mode *mode) {
+	fprintf(f, "%" PRId32 "x%" PRId32, mode->width, mode->height);
+	if (mode->refresh > 0) {
+		fprintf(f, "@%" PRId32 ".%03" PRId32,
+			mode->refresh / 1000, mode->refresh % 1000);
+	}
+}
+
+static void record_new_head(FILE *f, struct kanshi_head *head) {
+	fprintf(f, "head ");
+	record_string(f, head->name);
+	const struct {
+		const char *key, *value;
+	} props[] = {
+		{ "make", head->make },
+		{ "model", head->model },
+		{ "serial", head->serial_number },
+		{ "description", head->description },
+	};
+	for (size_t i = 0; i < sizeof(props) / sizeof(props[0]); i++) {
+		if (props[i].value != NULL) {
+			fprintf(f, " %s ", props[i].key);
+			record_string(f, props[i].value);
+		}
+	}
+	if (head->phys_width > 0 && head->phys_height > 0) {
+		fprintf(f, " size %" PRId32 "x%" PRId32,
+			head->phys_width, head->phys_height);
+	}
+	fputc('\n', f);
+}
+
+static void record_head_state(FILE *f, struct kanshi_head *head) {
+	fprintf(f, "state ");
+	record_string(f, head->name);
+	fprintf(f, " %s", head->enabled ? "enabled" : "disabled");
+	if (head->mode != NULL) {
+		fprintf(f, " mode ");
+		record_mode(f, head->mode);
+	}
+	fprintf(f, " position %" PRId32 ",%" PRId32 " transform %d scale %f"
+		" adaptive_sync %s\n", head->x, head->y, head->transform,
+		head->scale, head->adaptive_sync ? "on" : "off");
+}
+
+static bool head_state_changed(struct kanshi_head *head) {
+	struct kanshi_record_head *prev = head->record;
+	return prev->enabled != head->enabled || prev->mode != head->mode ||
+		prev->x != head->x || prev->y != head->y ||
+		prev->transform != head->transform ||
+		prev->scale < head->scale || prev->scale > head->scale ||
+		prev->adaptive_sync != head->adaptive_sync;
+}
+
+void kanshi_record_done(struct kanshi_state *state) {
+	struct kanshi_record *record = state->record;
+	if (record == NULL) {
+		return;
+	}
+	record_wait(record);
+
+	// Heads are inserted at the front of the list, write them in arrival
+	// order
+	struct kanshi_head *head;
+	wl_list_for_each_reverse(head, &state->heads, link) {
+		bool new_head = head->record == NULL;
+		if (new_head) {
+			head->record = calloc(1, sizeof(*head->record));
+			if (head->record == NULL) {
+				continue;
+			}
+			record_new_head(record->f, head);
+		}
+
+		int i = 0;
+		struct kanshi_mode *mode;
+		wl_list_for_each(mode, &head->modes, link) {
+			if (i++ < head->record->modes) {
+				continue;
+			}
+			fprintf(record->f, "mode ");
+			record_string(record->f, head->name);
+			fputc(' ', record->f);
+			record_mode(record->f, mode);
+			if (mode->preferred) {
+				fprintf(record->f, " preferred");
+			}
+			fputc('\n', record->f);
+		}
+		head->record->modes = i;
+
+		if (new_head || head_state_changed(head)) {
+			record_head_state(record->f, head);
+		}
+		head->record->enabled = head->enabled;
+		head->record->mode = head->mode;
+		head->record->x = head->x;
+		head->record->y = head->y;
+		head->record->transform = head->transform;
+		head->record->scale = head->scale;
+		head->record->adaptive_sync = head->adaptive_sync;
+	}
+
+	fprintf(record->f, "done\n");
+	fflush(record->f);
+}
+
+void kanshi_record_head_finished(struct kanshi_state *state,
+		struct kanshi_head *head) {
+	struct kanshi_record *record = state->record;
+	if (head->record == NULL) {
+		return;
+	}
+	free(head->record);
+	head->record = NULL;
+	if (record == NULL) {
+		return;
+	}
+
+	record_wait(record);
+	fprintf(record->f, "unplug ");
+	record_string(record->f, head->name);
+	fputc('\n', record->f);
+}
+
+void kanshi_record_apply(struct kanshi_state *state) {
+	struct kanshi_record *record = state->record;
+	if (record == NULL) {
+		return;
+	}
+	record_wait(record);
+	fprintf(record->f, "wait-apply %d\n", RECORD_APPLY_TIMEOUT_MS);
+	fflush(record->f);
+}
+
+void kanshi_record_reply(struct kanshi_state *state, const char *reply) {
+	struct kanshi_record *record = state->record;
+	if (record == NULL) {
+		return;
+	}
+	record_wait(record);
+	fprintf(record->f, "reply %s\n", reply);
+	fflush(record->f);
+}
+
+int kanshi_init_record(struct kanshi_state *state, const char *path) {
+	struct kanshi_record *record = calloc(1, sizeof(*record));
+	if (record == NULL) {
+		return -1;
+	}
+
+	record->f = fopen(path, "w");
+	if (record->f == NULL) {
+		kanshi_log(KANSHI_LOG_ERROR, "failed to open record file "
+			"path=\"%s\" error=\"%s\"", path, strerror(errno));
+		free(record);
+		return -1;
+	}
+	record->last_ns = get_time_ns();
+
+	fprintf(record->f, "# kanshi trace, replay with:\n"
+		"# mock-compositor [-f] <trace> -- kanshi [options...]\n"
+		"defer-replies\n");
+	fflush(record->f);
+
+	state->record = record;
+	return 0;
+}
+
+void kanshi_free_record(struct kanshi_state *state) {
+	struct kanshi_record *record = state->record;
+	if (record == NULL) {
+		return;
+	}
+	record_wait(record);
+	fprintf(record->f, "exit\n");
+	fclose(record->f);
+	free(record);
+	state->record = NULL;
+}
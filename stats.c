@@ -0,0 +1,200 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "log.h"
+#include "stats.h"
+
+uint64_t kanshi_stats_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void kanshi_stats_add_latency(struct kanshi_stats *stats, uint64_t ns) {
+	stats->latency_ns[stats->latency_index] = ns;
+	stats->latency_index =
+		(stats->latency_index + 1) % KANSHI_STATS_LATENCY_SAMPLES;
+	if (stats->latency_len < KANSHI_STATS_LATENCY_SAMPLES) {
+		stats->latency_len++;
+	}
+	stats->latency_count++;
+	stats->latency_sum_ns += ns;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+uint64_t kanshi_stats_latency_percentile(const struct kanshi_stats *stats,
+		unsigned int percentile) {
+	size_t n = stats->latency_len;
+	if (n == 0) {
+		return 0;
+	}
+
+	uint64_t sorted[KANSHI_STATS_LATENCY_SAMPLES];
+	memcpy(sorted, stats->latency_ns, n * sizeof(sorted[0]));
+	qsort(sorted, n, sizeof(sorted[0]), cmp_u64);
+
+	size_t rank = (percentile * n + 99) / 100;
+	if (rank > 0) {
+		rank--;
+	}
+	return sorted[rank < n ? rank : n - 1];
+}
+
+static void write_counter(FILE *f, const char *name, const char *help,
+		uint64_t value) {
+	fprintf(f, "# HELP %s %s\n# TYPE %s counter\n%s %" PRIu64 "\n",
+		name, help, name, name, value);
+}
+
+static void write_prometheus(FILE *f, const struct kanshi_stats *stats) {
+	write_counter(f, "kanshi_done_events_total",
+		"Output configuration changes received from the compositor.",
+		stats->done_events);
+
+	fprintf(f, "# HELP kanshi_matches_total Profile matches, computed "
+		"against the config or served by the current profile.\n"
+		"# TYPE kanshi_matches_total counter\n"
+		"kanshi_matches_total{result=\"computed\"} %" PRIu64 "\n"
+		"kanshi_matches_total{result=\"cached\"} %" PRIu64 "\n",
+		stats->matches, stats->match_cache_hits);
+
+	write_counter(f, "kanshi_applies_total",
+		"Output configurations sent to the compositor.", stats->applies);
+	fprintf(f, "# HELP kanshi_apply_results_total Compositor replies to "
+		"output configurations.\n"
+		"# TYPE kanshi_apply_results_total counter\n"
+		"kanshi_apply_results_total{result=\"succeeded\"} %" PRIu64 "\n"
+		"kanshi_apply_results_total{result=\"failed\"} %" PRIu64 "\n"
+		"kanshi_apply_results_total{result=\"cancelled\"} %" PRIu64 "\n",
+		stats->applies_succeeded, stats->applies_failed,
+		stats->applies_cancelled);
+
+	write_counter(f, "kanshi_apply_timeouts_total",
+		"Output configurations the compositor didn't reply to in time.",
+		stats->apply_timeouts);
+	write_counter(f, "kanshi_apply_retries_exhausted_total",
+		"Profiles given up after too many cancelled configurations.",
+		stats->apply_retries_exhausted);
+	write_counter(f, "kanshi_restores_total",
+		"Configurations restoring the output state after a failed apply.",
+		stats->restores);
+	write_counter(f, "kanshi_restore_failures_total",
+		"Restore configurations the compositor didn't apply.",
+		stats->restore_failures);
+	write_counter(f, "kanshi_commands_total",
+		"Profile exec commands spawned.", stats->commands);
+	write_counter(f, "kanshi_command_failures_total",
+		"Profile exec commands which could not be spawned.",
+		stats->command_failures);
+	write_counter(f, "kanshi_damped_heads_total",
+		"Times a flapping output was left out of matching.",
+		stats->damped_heads);
+	write_counter(f, "kanshi_config_reloads_total",
+		"Config reloads.", stats->reloads);
+	write_counter(f, "kanshi_config_reload_failures_total",
+		"Config reloads which failed to parse.", stats->reload_failures);
+
+	fprintf(f, "# HELP kanshi_config_parse_seconds Duration of the last "
+		"config parse.\n"
+		"# TYPE kanshi_config_parse_seconds gauge\n"
+		"kanshi_config_parse_seconds %f\n", stats->parse_ns / 1e9);
+
+	fprintf(f, "# HELP kanshi_recovery_seconds Time between a failed output "
+		"configuration and the previous state being restored.\n"
+		"# TYPE kanshi_recovery_seconds gauge\n"
+		"kanshi_recovery_seconds{stat=\"last\"} %f\n"
+		"kanshi_recovery_seconds{stat=\"max\"} %f\n",
+		stats->recovery_ns / 1e9, stats->recovery_max_ns / 1e9);
+
+	static const char *const pool_names[] = {
+		[KANSHI_POOL_HEADS] = "heads",
+		[KANSHI_POOL_MODES] = "modes",
+		[KANSHI_POOL_PENDING_PROFILES] = "pending_profiles",
+	};
+	fprintf(f, "# HELP kanshi_pool_allocations_total Objects allocated from "
+		"the pools, by the allocator or from the free list.\n"
+		"# TYPE kanshi_pool_allocations_total counter\n");
+	for (size_t i = 0; i < KANSHI_POOL_COUNT; i++) {
+		fprintf(f, "kanshi_pool_allocations_total{pool=\"%s\",source=\"malloc\"} "
+			"%" PRIu64 "\n"
+			"kanshi_pool_allocations_total{pool=\"%s\",source=\"free_list\"} "
+			"%" PRIu64 "\n",
+			pool_names[i], stats->pools[i].mallocs,
+			pool_names[i], stats->pools[i].reuses);
+	}
+	fprintf(f, "# HELP kanshi_pool_objects Objects of the pools in use, and "
+		"kept for reuse.\n"
+		"# TYPE kanshi_pool_objects gauge\n");
+	for (size_t i = 0; i < KANSHI_POOL_COUNT; i++) {
+		fprintf(f, "kanshi_pool_objects{pool=\"%s\",state=\"in_use\"} "
+			"%" PRIu64 "\n"
+			"kanshi_pool_objects{pool=\"%s\",state=\"free\"} %" PRIu64 "\n",
+			pool_names[i], stats->pools[i].in_use,
+			pool_names[i], stats->pools[i].free);
+	}
+
+	fprintf(f, "# HELP kanshi_apply_latency_seconds Time between sending an "
+		"output configuration and the compositor's reply.\n"
+		"# TYPE kanshi_apply_latency_seconds summary\n");
+	const struct {
+		const char *label;
+		unsigned int percentile;
+	} quantiles[] = {
+		{ "0.5", 50 },
+		{ "0.9", 90 },
+		{ "0.99", 99 },
+	};
+	for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++) {
+		uint64_t ns = kanshi_stats_latency_percentile(stats,
+			quantiles[i].percentile);
+		fprintf(f, "kanshi_apply_latency_seconds{quantile=\"%s\"} %f\n",
+			quantiles[i].label, ns / 1e9);
+	}
+	fprintf(f, "kanshi_apply_latency_seconds_sum %f\n"
+		"kanshi_apply_latency_seconds_count %" PRIu64 "\n",
+		stats->latency_sum_ns / 1e9, stats->latency_count);
+}
+
+void kanshi_stats_flush(const struct kanshi_stats *stats) {
+	if (stats->path == NULL) {
+		return;
+	}
+
+	// Write to a temporary file and rename it, so that collectors never read
+	// a partial file
+	char tmp_path[PATH_MAX];
+	if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", stats->path) >=
+			(int)sizeof(tmp_path)) {
+		kanshi_log(KANSHI_LOG_ERROR, "stats file path too long");
+		return;
+	}
+
+	FILE *f = fopen(tmp_path, "w");
+	if (f == NULL) {
+		kanshi_log(KANSHI_LOG_ERROR, "failed to open stats file "
+			"path=\"%s\" error=\"%s\"", tmp_path, strerror(errno));
+		return;
+	}
+	write_prometheus(f, stats);
+	if (fclose(f) != 0) {
+		kanshi_log(KANSHI_LOG_ERROR, "failed to write stats file "
+			"path=\"%s\" error=\"%s\"", tmp_path, strerror(errno));
+		remove(tmp_path);
+		return;
+	}
+	if (rename(tmp_path, stats->path) != 0) {
+		kanshi_log(KANSHI_LOG_ERROR, "failed to rename stats file "
+			"path=\"%s\" error=\"%s\"", tmp_path, strerror(errno));
+		remove(tmp_path);
+	}
+}
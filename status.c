@@ -0,0 +1,175 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "ipc.h"
+#include "kanshi.h"
+#include "log.h"
+#include "match.h"
+#include "status.h"
+
+struct kanshi_status_file {
+	int fd;
+	struct kanshi_status *status;
+	char path[PATH_MAX];
+};
+
+static void fill_status(struct kanshi_state *state,
+		struct kanshi_status *status) {
+	struct kanshi_profile *current = state->current_profile;
+	if (current != NULL) {
+		snprintf(status->current_profile, sizeof(status->current_profile),
+			"%s", current->name);
+	}
+	if (state->pending_profile != NULL) {
+		snprintf(status->pending_profile, sizeof(status->pending_profile),
+			"%s", state->pending_profile->name);
+	}
+
+	struct kanshi_profile_output *matches[HEADS_MAX];
+	bool matched = current != NULL &&
+		match_profile(&state->heads, current, matches);
+
+	// matches is indexed by position in the head list, the status by
+	// announced head
+	size_t i = 0, len = 0;
+	struct kanshi_head *head;
+	wl_list_for_each(head, &state->heads, link) {
+		if (len >= KANSHI_STATUS_HEADS_MAX) {
+			break;
+		}
+		if (!head->announced || head->name == NULL) {
+			// Its properties are still being sent
+			i++;
+			continue;
+		}
+		struct kanshi_status_head *status_head = &status->heads[len];
+		snprintf(status_head->name, sizeof(status_head->name), "%s",
+			head->name);
+		if (matched && matches[i] != NULL) {
+			snprintf(status_head->output, sizeof(status_head->output), "%s",
+				matches[i]->name);
+		}
+		status_head->enabled = head->enabled;
+		if (head->mode != NULL) {
+			status_head->width = head->mode->width;
+			status_head->height = head->mode->height;
+			status_head->refresh = head->mode->refresh;
+		}
+		status_head->x = head->x;
+		status_head->y = head->y;
+		status_head->transform = head->transform;
+		status_head->scale = head->scale;
+		i++;
+		len++;
+	}
+	status->heads_len = len;
+}
+
+void kanshi_update_status(struct kanshi_state *state) {
+	struct kanshi_status_file *file = state->status;
+	if (file == NULL) {
+		return;
+	}
+
+	struct kanshi_status next;
+	memset(&next, 0, sizeof(next));
+	fill_status(state, &next);
+
+	// Everything from current_profile onwards is the payload
+	struct kanshi_status *status = file->status;
+	size_t payload = offsetof(struct kanshi_status, current_profile);
+	if (status->heads_len == next.heads_len &&
+			memcmp((char *)status + payload, (char *)&next + payload,
+				sizeof(next) - payload) == 0) {
+		return;
+	}
+
+	uint32_t seq = status->seq;
+	__atomic_store_n(&status->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	status->heads_len = next.heads_len;
+	status->generation++;
+	memcpy((char *)status + payload, (char *)&next + payload,
+		sizeof(next) - payload);
+	__atomic_store_n(&status->seq, seq + 2, __ATOMIC_RELEASE);
+
+	// Writes through the mapping don't generate inotify events
+	if (futimens(file->fd, NULL) != 0) {
+		kanshi_log(KANSHI_LOG_ERROR, "failed to update status file "
+			"timestamp error=\"%s\"", strerror(errno));
+	}
+}
+
+int kanshi_init_status(struct kanshi_state *state) {
+	struct kanshi_status_file *file = calloc(1, sizeof(*file));
+	if (file == NULL) {
+		return -1;
+	}
+	file->fd = -1;
+
+	if (get_status_path(file->path, sizeof(file->path)) < 0) {
+		goto error;
+	}
+
+	// Don't truncate a stale file: readers still mapping it would crash
+	file->fd = open(file->path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (file->fd < 0) {
+		kanshi_log(KANSHI_LOG_ERROR, "failed to open status file "
+			"path=\"%s\" error=\"%s\"", file->path, strerror(errno));
+		goto error;
+	}
+	if (ftruncate(file->fd, sizeof(struct kanshi_status)) != 0) {
+		kanshi_log(KANSHI_LOG_ERROR, "failed to resize status file "
+			"error=\"%s\"", strerror(errno));
+		goto error;
+	}
+	file->status = mmap(NULL, sizeof(struct kanshi_status),
+		PROT_READ | PROT_WRITE, MAP_SHARED, file->fd, 0);
+	if (file->status == MAP_FAILED) {
+		kanshi_log(KANSHI_LOG_ERROR, "failed to map status file "
+			"error=\"%s\"", strerror(errno));
+		file->status = NULL;
+		goto error;
+	}
+
+	struct kanshi_status *status = file->status;
+	if (status->seq % 2 != 0) {
+		// A previous instance crashed in the middle of an update
+		status->seq++;
+	}
+	status->magic = KANSHI_STATUS_MAGIC;
+	status->version = KANSHI_STATUS_VERSION;
+
+	state->status = file;
+	kanshi_update_status(state);
+	return 0;
+
+error:
+	if (file->fd >= 0) {
+		close(file->fd);
+	}
+	free(file);
+	return -1;
+}
+
+void kanshi_free_status(struct kanshi_state *state) {
+	struct kanshi_status_file *file = state->status;
+	if (file == NULL) {
+		return;
+	}
+	unlink(file->path);
+	munmap(file->status, sizeof(struct kanshi_status));
+	close(file->fd);
+	free(file);
+	state->status = NULL;
+}